@@ -6,6 +6,92 @@
 #include "vendor/dca3/thread.h"
 #include <iostream>
 #include <queue>
+#include <algorithm>
+
+#define STREAM_STAGING_BUFFER_SIZE 16384
+#define STREAM_STAGING_READ_SIZE_STEREO 16384
+#define STREAM_STAGING_READ_SIZE_MONO (STREAM_STAGING_READ_SIZE_STEREO / 2)
+#define STREAM_CHANNEL_BUFFER_SIZE (STREAM_STAGING_READ_SIZE_MONO * 2)	// lower and upper halves
+#define STREAM_CHANNEL_SAMPLE_COUNT (STREAM_CHANNEL_BUFFER_SIZE * 2)		// 4 bit adpcm
+
+// SFX one shots are only checked for completion, this bounds how late a channel is released
+#define SFX_POLL_MS 50
+
+// Where a stream is in its clip and which aica half buffer it refills next. Kept apart
+// from the hardware side so the sim can check the refill schedule, see check_stream_refills
+struct stream_cursor_t {
+	int rate;
+	int total_samples;
+	int played_samples;
+	bool next_is_upper_half;
+	bool first_refill;
+};
+
+struct stream_step_t {
+	bool refill;            // copy staging to the half at aica_offset
+	uint32_t aica_offset;
+	bool fetch;             // then queue the next read to staging
+	bool ended;             // played past the end of the clip
+};
+
+// Advances the cursor to the channel play position, once per streamer wake up
+static stream_step_t stream_advance(stream_cursor_t& cursor, uint32_t channel_pos) {
+	stream_step_t step = { };
+
+	uint32_t logical_pos = channel_pos;
+	if (logical_pos > STREAM_CHANNEL_SAMPLE_COUNT/2) {
+		logical_pos -= STREAM_CHANNEL_SAMPLE_COUNT/2;
+	}
+
+	bool can_refill = (cursor.played_samples + STREAM_CHANNEL_SAMPLE_COUNT/2 + (!cursor.first_refill)*STREAM_CHANNEL_SAMPLE_COUNT/2) < cursor.total_samples;
+	bool can_fetch = (cursor.played_samples + STREAM_CHANNEL_SAMPLE_COUNT/2 + STREAM_CHANNEL_SAMPLE_COUNT/2 + (!cursor.first_refill)*STREAM_CHANNEL_SAMPLE_COUNT/2) < cursor.total_samples;
+	if (channel_pos >= STREAM_CHANNEL_SAMPLE_COUNT/2 && !cursor.next_is_upper_half) {
+		cursor.next_is_upper_half = true;
+		// fill lower half, and queue the next read to staging if any
+		step.refill = can_refill;
+		step.aica_offset = 0;
+		step.fetch = can_refill && can_fetch;
+		assert(cursor.first_refill == false);
+		cursor.played_samples += STREAM_CHANNEL_SAMPLE_COUNT/2;
+	} else if (channel_pos < STREAM_CHANNEL_SAMPLE_COUNT/2 && cursor.next_is_upper_half) {
+		cursor.next_is_upper_half = false;
+		// fill upper half, and queue the next read to staging if any
+		step.refill = can_refill;
+		step.aica_offset = STREAM_CHANNEL_BUFFER_SIZE/2;
+		step.fetch = can_refill && can_fetch;
+		if (cursor.first_refill) {
+			cursor.first_refill = false;
+		} else {
+			cursor.played_samples += STREAM_CHANNEL_SAMPLE_COUNT/2;
+		}
+	}
+
+	step.ended = (cursor.played_samples + logical_pos) > (uint32_t)cursor.total_samples;
+	return step;
+}
+
+// Milliseconds until the stream reaches its next half buffer boundary or the end of the clip
+static unsigned stream_refill_delay_ms(const stream_cursor_t& cursor, uint32_t channel_pos) {
+	// a stream at pitch 0 never gets anywhere, just look again later
+	if (cursor.rate <= 0) {
+		return SFX_POLL_MS;
+	}
+
+	uint32_t boundary = cursor.next_is_upper_half ? STREAM_CHANNEL_SAMPLE_COUNT : STREAM_CHANNEL_SAMPLE_COUNT/2;
+	uint32_t remaining = channel_pos < boundary ? boundary - channel_pos : 0;
+
+	uint32_t logical_pos = channel_pos;
+	if (logical_pos > STREAM_CHANNEL_SAMPLE_COUNT/2) {
+		logical_pos -= STREAM_CHANNEL_SAMPLE_COUNT/2;
+	}
+	int to_end = cursor.total_samples - cursor.played_samples - (int)logical_pos + 1;
+	if (to_end >= 0 && (uint32_t)to_end < remaining) {
+		remaining = to_end;
+	}
+
+	// +1 so that we wake up after the boundary, not right before it
+	return remaining * 1000 / cursor.rate + 1;
+}
 
 #if defined(DC_SH4)
 #include <dc/sound/sound.h>
@@ -22,12 +108,6 @@
 #define debugf(...)  // dbglog(DBG_CRITICAL, __VA_ARGS__)
 #define infof(...) dbglog(DBG_CRITICAL, __VA_ARGS__)
 
-#define STREAM_STAGING_BUFFER_SIZE 16384
-#define STREAM_STAGING_READ_SIZE_STEREO 16384
-#define STREAM_STAGING_READ_SIZE_MONO (STREAM_STAGING_READ_SIZE_STEREO / 2)
-#define STREAM_CHANNEL_BUFFER_SIZE (STREAM_STAGING_READ_SIZE_MONO * 2)	// lower and upper halves
-#define STREAM_CHANNEL_SAMPLE_COUNT (STREAM_CHANNEL_BUFFER_SIZE * 2)		// 4 bit adpcm
-
 #define SPU_RAM_UNCACHED_BASE_U8 ((uint8_t *)SPU_RAM_UNCACHED_BASE)
 // ************************************************************************************************
 // Begin AICA Driver stuff
@@ -155,9 +235,7 @@ struct alignas(32) stream_info {
 	file_t fd;
 	uint32_t aica_buffers[2]; // left, right
 	int mapped_ch[2];	// left, right
-	int rate;
-	int total_samples;
-	int played_samples;
+	stream_cursor_t cursor;
 	int file_offset;
 	int vol;
 	uint8_t nPan;
@@ -165,8 +243,6 @@ struct alignas(32) stream_info {
 	audio_source_t* source; // if non null it is playing
 
 	bool stereo;
-	bool next_is_upper_half;
-	bool first_refill;
 	bool paused;
 }; 
 
@@ -217,8 +293,20 @@ void* audio_io_thread(void*) {
     }
 }
 
+// Wakes the streamer when the set of playing channels changes
+static semaphore_t refill_sema = SEM_INITIALIZER(0);
+
 void* audio_periodical(void*) {
+    struct {
+        audio_source_t* source;
+        uint32_t version;
+        uint32_t aica_offset;
+        size_t do_read;
+    } refills[MAX_STREAMS];
+
     for(;;) {
+        unsigned sleep_ms = UINT32_MAX;
+
         auto mask = irq_disable();
 
         {
@@ -230,6 +318,7 @@ void* audio_periodical(void*) {
 
                     if (chn_version[mapped_ch] != channel_version) {
                         syncf("SFX version missmatch, skipping update. expected %d got %d\n", chn_version[mapped_ch], channel_version);
+                        sleep_ms = std::min(sleep_ms, (unsigned)SFX_POLL_MS);
                         continue;
                     }
                     // uint16_t channel_pos = (g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_CHANNEL(mapped_ch) + offsetof(aica_channel_t, pos)) & 0xffff);
@@ -241,6 +330,8 @@ void* audio_periodical(void*) {
                             debugf("Auto stopping channel: %d -> %d\n", i, mapped_ch);
                             sfx_channel[i].source->playingChannel = -1;
                             sfx_channel[i].source = nullptr;
+                        } else {
+                            sleep_ms = std::min(sleep_ms, (unsigned)SFX_POLL_MS);
                         }
                     }
                 }
@@ -248,70 +339,41 @@ void* audio_periodical(void*) {
         }
 
         for (int i = 0; i< MAX_STREAMS; i++) {
-            size_t do_read = 0;
+            refills[i].source = nullptr;
+            refills[i].do_read = 0;
             {
                 if (streams[i].source != nullptr) {
                     uint32_t channel_version = g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_CHANNEL(streams[i].mapped_ch[0]) + offsetof(aica_channel_t, version));
 
                     if (chn_version[streams[i].mapped_ch[0]] != channel_version) {
                         syncf("Stream version missmatch, skipping update. expected %d got %d\n", chn_version[streams[i].mapped_ch[0]], channel_version);
+                        // the channel start command is still in flight
+                        sleep_ms = std::min(sleep_ms, 1u);
                         continue;
                     }
                     // get channel pos
                     uint32_t channel_pos = g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_CHANNEL(streams[i].mapped_ch[0]) + offsetof(aica_channel_t, pos)) & 0xffff;
-                    uint32_t logical_pos = channel_pos;
-                    if (logical_pos > STREAM_CHANNEL_SAMPLE_COUNT/2) {
-                        logical_pos -= STREAM_CHANNEL_SAMPLE_COUNT/2;
-                    }
-                    streamf("Stream %d pos: %d, log: %d, played: %d\n", i, channel_pos, logical_pos, streams[i].played_samples);
-        
-                    bool can_refill = (streams[i].played_samples + STREAM_CHANNEL_SAMPLE_COUNT/2 + (!streams[i].first_refill)*STREAM_CHANNEL_SAMPLE_COUNT/2) < streams[i].total_samples;
-                    bool can_fetch = (streams[i].played_samples + STREAM_CHANNEL_SAMPLE_COUNT/2 + STREAM_CHANNEL_SAMPLE_COUNT/2 + (!streams[i].first_refill)*STREAM_CHANNEL_SAMPLE_COUNT/2) < streams[i].total_samples;
-                    // copy over data if needed from staging
-                    if (channel_pos >= STREAM_CHANNEL_SAMPLE_COUNT/2 && !streams[i].next_is_upper_half) {
-                        streams[i].next_is_upper_half = true;
-                        if (can_refill) { // could we need a refill?
-                            streamf("Filling channel %d with lower half\n", i);
-                            // fill lower half
-                            spu_memload(streams[i].aica_buffers[0], streams[i].buffer, STREAM_CHANNEL_BUFFER_SIZE/2);
-                            if (streams[i].stereo) {
-                                spu_memload(streams[i].aica_buffers[1], streams[i].buffer + STREAM_STAGING_READ_SIZE_MONO, STREAM_CHANNEL_BUFFER_SIZE/2);
-                            }
-                            // queue next read to staging if any
-                            if (can_fetch) {
-                                do_read = streams[i].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO;
-                            }
-                        }
-                        assert(streams[i].first_refill == false);
-                        streams[i].played_samples += STREAM_CHANNEL_SAMPLE_COUNT/2;
-                    } else if (channel_pos < STREAM_CHANNEL_SAMPLE_COUNT/2 && streams[i].next_is_upper_half) {
-                        streams[i].next_is_upper_half = false;
-                        if (can_refill) { // could we need a refill?
-                            streamf("Filling channel %d with upper half\n", i);
-                            // fill upper half
-                            spu_memload(streams[i].aica_buffers[0] + STREAM_CHANNEL_BUFFER_SIZE/2, streams[i].buffer, STREAM_CHANNEL_BUFFER_SIZE/2);
-                            if (streams[i].stereo) {
-                                spu_memload(streams[i].aica_buffers[1] + STREAM_CHANNEL_BUFFER_SIZE/2, streams[i].buffer + STREAM_STAGING_READ_SIZE_MONO, STREAM_CHANNEL_BUFFER_SIZE/2);
-                            }
-                            // queue next read to staging, if any
-                            if (can_fetch) {
-                                do_read = streams[i].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO;
-                            }
-                        }
-                        if (streams[i].first_refill) {
-                            streams[i].first_refill = false;
-                        } else {
-                            streams[i].played_samples += STREAM_CHANNEL_SAMPLE_COUNT/2;
+                    streamf("Stream %d pos: %d, played: %d\n", i, channel_pos, streams[i].cursor.played_samples);
+
+                    // schedule copy over from staging if needed, spu_memload runs after the irq off window
+                    auto step = stream_advance(streams[i].cursor, channel_pos);
+                    if (step.refill) {
+                        streamf("Filling channel %d at %d\n", i, step.aica_offset);
+                        refills[i].source = streams[i].source;
+                        refills[i].aica_offset = step.aica_offset;
+                        if (step.fetch) {
+                            refills[i].do_read = streams[i].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO;
                         }
                     }
+                    refills[i].version = channel_version;
                     // if end of file, stop
-                    if ((streams[i].played_samples + logical_pos) > streams[i].total_samples) {
+                    if (step.ended) {
                         if (streams[i].source->loop) {
                             streams[i].file_offset = 0;
-                            streams[i].played_samples = 0;
+                            streams[i].cursor.played_samples = 0;
                         } else {
                             // stop channel
-                            streamf("Auto stopping stream: %d -> {%d, %d}, %d total\n", i, streams[i].mapped_ch[0], streams[i].mapped_ch[1], streams[i].total_samples);
+                            streamf("Auto stopping stream: %d -> {%d, %d}, %d total\n", i, streams[i].mapped_ch[0], streams[i].mapped_ch[1], streams[i].cursor.total_samples);
                             aica_stop_chn(streams[i].mapped_ch[0]);
                             aica_stop_chn(streams[i].mapped_ch[1]);
                             streams[i].source->playingChannel = -1;
@@ -319,20 +381,54 @@ void* audio_periodical(void*) {
                             fs_close(streams[i].fd);
                             streams[i].fd = -1;
     
-                            assert(do_read == 0);
+                            assert(refills[i].do_read == 0);
+                            refills[i].source = nullptr;
+                            continue;
                         }
                     }
-                }
-                
-                if (do_read) {
-                    streamf("Queueing stream read: %d, file: %d, buffer: %p, size: %d, file_offset: %d\n", i, streams[i].fd, streams[i].buffer, do_read, streams[i].file_offset);
-                    queue_read(streams[i].fd, streams[i].file_offset, streams[i].buffer, do_read);
-                    streams[i].file_offset += do_read;
+
+                    sleep_ms = std::min(sleep_ms, stream_refill_delay_ms(streams[i].cursor, channel_pos));
                 }
             }
         }
         irq_restore(mask);
-        thd_sleep(50);
+
+        // Copy staging to AICA with irqs enabled. play() and disable() set up and tear down
+        // streams under the stream mutex, so once the source/version check passes here the
+        // fd, file offset and staging buffer stay put until the read is queued
+        for (int i = 0; i< MAX_STREAMS; i++) {
+            if (refills[i].source == nullptr) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(streams[i].mtx);
+
+            mask = irq_disable();
+            bool current = streams[i].source == refills[i].source && chn_version[streams[i].mapped_ch[0]] == refills[i].version;
+            irq_restore(mask);
+
+            if (!current) {
+                continue;
+            }
+
+            spu_memload(streams[i].aica_buffers[0] + refills[i].aica_offset, streams[i].buffer, STREAM_CHANNEL_BUFFER_SIZE/2);
+            if (streams[i].stereo) {
+                spu_memload(streams[i].aica_buffers[1] + refills[i].aica_offset, streams[i].buffer + STREAM_STAGING_READ_SIZE_MONO, STREAM_CHANNEL_BUFFER_SIZE/2);
+            }
+
+            if (refills[i].do_read) {
+                streamf("Queueing stream read: %d, file: %d, buffer: %p, size: %d, file_offset: %d\n", i, streams[i].fd, streams[i].buffer, refills[i].do_read, streams[i].file_offset);
+                queue_read(streams[i].fd, streams[i].file_offset, streams[i].buffer, refills[i].do_read);
+                streams[i].file_offset += refills[i].do_read;
+            }
+        }
+
+        if (sleep_ms == UINT32_MAX) {
+            // nothing playing, wait for play()
+            sem_wait(&refill_sema);
+        } else {
+            sem_wait_timed(&refill_sema, sleep_ms);
+        }
     }
 
     return nullptr;
@@ -442,89 +538,98 @@ void audio_source_t::play() {
         }
         irq_restore(mask);
     } else {
+        // only the main thread starts streams, so a free slot stays free until it is marked playing below
+        int nStream = -1;
         auto mask = irq_disable();
-        {
-            for (unsigned i = 0; i < MAX_STREAMS; i++) {
-                if (streams[i].source == nullptr) {
-                    int f = fs_open(this->clip->file, O_RDONLY);
-                    assert(f >= 0);
-
-                    auto nStream = i;
-                    streams[nStream].rate = (int)(this->clip->sampleRate * this->pitch);
-                    streams[nStream].stereo = false;
-                    streams[nStream].pan[0] = 0;
-                    streams[nStream].pan[1] = 255;
-                    streams[nStream].vol = (int)(this->volume * 255);
-
-                    assert(streams[nStream].fd == -1);
-                    // if (streams[nStream].fd >= 0) {
-                    //     CdStreamDiscardAudioRead(streams[nStream].fd);
-                    //     fs_close(streams[nStream].fd);
-                    // }
-                    streams[nStream].fd = f;
-                    streams[nStream].total_samples = this->clip->totalSamples;
-                    streams[nStream].played_samples = 0;
-                    streams[nStream].next_is_upper_half = true;
-                    streams[nStream].first_refill = true;
-
-                    // streamf("PreloadStreamedFile: %s: stream: %d, freq: %d, chans: %d, byte size: %d, played samples: %d\n", DCStreamedNameTable[nFile], nStream, hdr.samplesPerSec, hdr.numOfChan, hdr.dataSize, streams[nStream].played_samples);
-                
-                    irq_restore(mask);
-                    #if 0
-                    // Read directly in the future
-                    fs_read(f, SPU_RAM_UNCACHED_BASE_U8 + streams[nStream].aica_buffers[0], STREAM_STAGING_READ_SIZE_MONO);
-                    if (streams[nStream].stereo) {
-                        fs_read(f, SPU_RAM_UNCACHED_BASE_U8 + streams[nStream].aica_buffers[1], STREAM_STAGING_READ_SIZE_MONO);
-                    }
-                    #else
-                    // Stage to memory
-                    fs_read(f, streams[nStream].buffer, streams[nStream].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO);
-                    spu_memload(streams[nStream].aica_buffers[0], streams[nStream].buffer, STREAM_CHANNEL_BUFFER_SIZE/2);
-                    if (streams[nStream].stereo) {
-                        spu_memload(streams[nStream].aica_buffers[1], streams[nStream].buffer + STREAM_STAGING_READ_SIZE_MONO, STREAM_CHANNEL_BUFFER_SIZE/2);
-                    }
-                    #endif
-
-                    if (streams[nStream].total_samples > STREAM_CHANNEL_SAMPLE_COUNT/2) {
-                        // If more than one buffer, prefetch the next one
-                        fs_read(f, streams[nStream].buffer, streams[nStream].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO);
-                    }
+        for (unsigned i = 0; i < MAX_STREAMS; i++) {
+            if (streams[i].source == nullptr) {
+                nStream = i;
+                break;
+            }
+        }
+        irq_restore(mask);
 
-                    mask = irq_disable();
-                    streams[nStream].file_offset = fs_tell(f);
+        if (nStream != -1) {
+            int f = fs_open(this->clip->file, O_RDONLY);
+            assert(f >= 0);
+
+            // set up under the stream mutex so a refill still in flight for the slot's
+            // previous stream finishes first, and then fails its version check
+            std::lock_guard<std::mutex> lock(streams[nStream].mtx);
+
+            streams[nStream].cursor.rate = (int)(this->clip->sampleRate * this->pitch);
+            streams[nStream].stereo = false;
+            streams[nStream].pan[0] = 0;
+            streams[nStream].pan[1] = 255;
+            streams[nStream].vol = (int)(this->volume * 255);
+
+            assert(streams[nStream].fd == -1);
+            // if (streams[nStream].fd >= 0) {
+            //     CdStreamDiscardAudioRead(streams[nStream].fd);
+            //     fs_close(streams[nStream].fd);
+            // }
+            streams[nStream].fd = f;
+            streams[nStream].cursor.total_samples = this->clip->totalSamples;
+            streams[nStream].cursor.played_samples = 0;
+            streams[nStream].cursor.next_is_upper_half = true;
+            streams[nStream].cursor.first_refill = true;
+
+            #if 0
+            // Read directly in the future
+            fs_read(f, SPU_RAM_UNCACHED_BASE_U8 + streams[nStream].aica_buffers[0], STREAM_STAGING_READ_SIZE_MONO);
+            if (streams[nStream].stereo) {
+                fs_read(f, SPU_RAM_UNCACHED_BASE_U8 + streams[nStream].aica_buffers[1], STREAM_STAGING_READ_SIZE_MONO);
+            }
+            #else
+            // Stage to memory
+            fs_read(f, streams[nStream].buffer, streams[nStream].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO);
+            spu_memload(streams[nStream].aica_buffers[0], streams[nStream].buffer, STREAM_CHANNEL_BUFFER_SIZE/2);
+            if (streams[nStream].stereo) {
+                spu_memload(streams[nStream].aica_buffers[1], streams[nStream].buffer + STREAM_STAGING_READ_SIZE_MONO, STREAM_CHANNEL_BUFFER_SIZE/2);
+            }
+            #endif
 
-                    // mark as playing
-                    streams[i].source = this;
-                    this->playingChannel = i;
+            if (streams[nStream].cursor.total_samples > STREAM_CHANNEL_SAMPLE_COUNT/2) {
+                // If more than one buffer, prefetch the next one
+                fs_read(f, streams[nStream].buffer, streams[nStream].stereo ? STREAM_STAGING_READ_SIZE_STEREO : STREAM_STAGING_READ_SIZE_MONO);
+            }
 
-                    aica_play_chn(
-                        streams[nStream].mapped_ch[0],
-                        STREAM_CHANNEL_SAMPLE_COUNT,
-                        streams[nStream].aica_buffers[0],
-                        3 /* adpcm long stream */,
-                        streams[nStream].vol,
-                        streams[nStream].pan[0],
-                        1,
-                        streams[nStream].rate
-                    );
-                
-                    aica_play_chn(
-                        streams[nStream].mapped_ch[1],
-                        STREAM_CHANNEL_SAMPLE_COUNT,
-                        streams[nStream].aica_buffers[streams[nStream].stereo ? 1 : 0],
-                        3 /* adpcm long stream */,
-                        streams[nStream].vol,
-                        streams[nStream].pan[1],
-                        1,
-                        streams[nStream].rate
-                    );
+            streams[nStream].file_offset = fs_tell(f);
+
+            mask = irq_disable();
+
+            // mark as playing
+            streams[nStream].source = this;
+            this->playingChannel = nStream;
+
+            aica_play_chn(
+                streams[nStream].mapped_ch[0],
+                STREAM_CHANNEL_SAMPLE_COUNT,
+                streams[nStream].aica_buffers[0],
+                3 /* adpcm long stream */,
+                streams[nStream].vol,
+                streams[nStream].pan[0],
+                1,
+                streams[nStream].cursor.rate
+            );
+
+            aica_play_chn(
+                streams[nStream].mapped_ch[1],
+                STREAM_CHANNEL_SAMPLE_COUNT,
+                streams[nStream].aica_buffers[streams[nStream].stereo ? 1 : 0],
+                3 /* adpcm long stream */,
+                streams[nStream].vol,
+                streams[nStream].pan[1],
+                1,
+                streams[nStream].cursor.rate
+            );
 
-                    break;
-                }
-            }
+            irq_restore(mask);
         }
-        irq_restore(mask);
     }
+
+    // reschedule the streamer for the new channel
+    sem_signal(&refill_sema);
 }
 void audio_source_t::awake() {
     if (playOnAwake) {
@@ -535,7 +640,18 @@ void audio_source_t::awake() {
 }
 
 void audio_source_t::disable() {
+    // streams are torn down under the stream mutex, so the streamer never copies to or
+    // queues a read for a stream that is being closed
+    std::unique_lock<std::mutex> streamLock;
     auto mask = irq_disable();
+    int channel = this->playingChannel;
+    if (channel != -1 && !this->clip->isSfx) {
+        irq_restore(mask);
+        streamLock = std::unique_lock<std::mutex>(streams[channel].mtx);
+        mask = irq_disable();
+        // the streamer may have auto stopped it meanwhile
+        assert(this->playingChannel == -1 || this->playingChannel == channel);
+    }
     infof("audio source %d, %d was disabled\n", find_audio_source_num(this), this->playingChannel);
     if (this->playingChannel != -1) {
         if (this->clip->isSfx) {
@@ -609,6 +725,104 @@ void audio_source_t::update(native::game_object_t* go) {}
 
 #endif
 
+#if defined(DC_SIM)
+// tlj-sim.elf --check-audio: plays streams against a simulated channel position and
+// wakes the streamer when stream_refill_delay_ms asks, plus scheduling latency. Every
+// half buffer must hold the right chunk by the time the channel starts playing it and
+// must not be refilled while it plays. Reads to staging are assumed to land before the
+// next refill, the io thread gets the better part of a half buffer for that
+bool check_stream_refills() {
+	const int rates[] = { 8000, 11025, 22050, 32000, 44100, 48000, 96000 };
+	const int halfBuffers[] = { 0, 1, 2, 3, 10, 200 };
+	const unsigned latenciesMs[] = { 0, 5, 20, 50 };
+	constexpr int half = STREAM_CHANNEL_SAMPLE_COUNT/2;
+
+	bool ok = true;
+	uint32_t seed = 1;
+	auto jitterUs = [&seed](unsigned maxMs) {
+		seed = seed * 1664525 + 1013904223;
+		return maxMs ? (seed >> 8) % (maxMs * 1000 + 1) : 0;
+	};
+
+	// a stream at pitch 0 must still get polled
+	stream_cursor_t stalled = { 0, half * 4, 0, true, true };
+	if (stream_refill_delay_ms(stalled, 0) > SFX_POLL_MS) {
+		std::cout << "check-audio: a rate 0 stream isn't polled" << std::endl;
+		ok = false;
+	}
+
+	for (auto rate: rates) {
+		for (auto halves: halfBuffers) {
+			for (int extra: { 1, half / 3 }) {
+				for (auto latencyMs: latenciesMs) {
+					int total = halves * half + extra;
+					// as set up by play(): first chunk in the lower half, second one staged
+					stream_cursor_t cursor = { rate, total, 0, true, true };
+					int halfChunk[2] = { 0, -1 };
+					int staged = 1;
+					int checked = -1;
+					uint64_t t = jitterUs(latencyMs);
+					bool ended = false;
+
+					auto fail = [&](const char* what, uint64_t sample) {
+						std::cout << "check-audio: " << what << " at sample " << sample << ", rate " << rate
+							<< ", " << total << " samples, " << latencyMs << " ms latency" << std::endl;
+						ok = false;
+					};
+
+					for (unsigned wakes = 0; !ended && wakes < 100000; wakes++) {
+						uint64_t sample = t * rate / 1000000;
+						int current = sample / half;
+
+						// everything the channel started since the previous wake up
+						for (int n = checked + 1; n <= current && (int64_t)n * half < total; n++) {
+							if (halfChunk[n % 2] != n) {
+								fail("underrun", (uint64_t)n * half);
+								break;
+							}
+						}
+						checked = current;
+
+						auto step = stream_advance(cursor, sample % STREAM_CHANNEL_SAMPLE_COUNT);
+						if (step.refill) {
+							int refilled = step.aica_offset ? 1 : 0;
+							if (refilled == current % 2 && (int64_t)current * half < total) {
+								fail("refilled the half that is playing", sample);
+							}
+							halfChunk[refilled] = staged;
+							staged = step.fetch ? staged + 1 : -1;
+						}
+						if (step.ended) {
+							if (sample < (uint64_t)total) {
+								fail("stopped early", sample);
+							}
+							// past the end the channel plays stale data until the streamer stops it
+							if (sample > (uint64_t)total + (uint64_t)rate * (latencyMs + 2) / 1000) {
+								fail("stopped late", sample);
+							}
+							ended = true;
+							break;
+						}
+
+						t += stream_refill_delay_ms(cursor, sample % STREAM_CHANNEL_SAMPLE_COUNT) * 1000ull + jitterUs(latencyMs);
+					}
+
+					if (!ended) {
+						fail("never stopped", t * rate / 1000000);
+					}
+					if (!ok) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	std::cout << "check-audio: stream refills OK" << std::endl;
+	return ok;
+}
+#endif
+
 void audio_source_t::setEnabled(bool nv) {
     if (enabled != nv) {
         enabled = nv;
@@ -99,6 +99,12 @@ enum component_type_t {
     ct_eol = -1
 };
 
+// dense numbering of component_type_t, used for game_object_t::componentMask
+constexpr unsigned componentSlot(component_type_t type) {
+    return type >= ct_interaction ? (ct_mesh_collider + 1) + (type - ct_interaction) : type;
+}
+static_assert(componentSlot(ct_fadeout) < 32);
+
 struct component_base_t {
     native::game_object_t* gameObject;
 };
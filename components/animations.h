@@ -49,11 +49,19 @@ enum animation_property_key
     MeshRenderer_m_Materials_0,
 };
 
+// keys are quantised by the exporter, see ProcessAnimations
+// constant tracks have a single key
 struct animation_track_t {
-    float* times;
-    float* values;
+    uint16_t* times;
+    uint16_t* values;
     size_t num_keys;
     animation_property_key property_key;
+    float timeScale;
+    float valueOffset;
+    float valueScale;
+
+    float keyTime(size_t key) const { return times[key] * timeScale; }
+    float keyValue(size_t key) const { return valueOffset + values[key] * valueScale; }
 };
 
 struct animation_t {
@@ -62,11 +70,23 @@ struct animation_t {
     float maxTime;
 };
 
+struct animation_binding_t;
+// key is the value of the current keyframe, sample the interpolated one
+typedef void (*animation_setter_t)(const animation_binding_t& binding, float key, float sample);
+
+// a track resolved to the field or component it writes, see animator_t::bind
+struct animation_binding_t {
+    animation_setter_t set;
+    void* target;
+    native::game_object_t* gameObject;
+};
+
 struct bound_animation_t {
     animation_t* animation;
     size_t* bindings;
     unsigned* currentFrames;
     float currentTime;
+    animation_binding_t* targets;
 };
 
 struct animator_t {
@@ -77,6 +97,8 @@ struct animator_t {
     size_t num_bound_animations;
     size_t gameObjectIndex;
 
+    // resolves bindings into targets, after components are initialized
+    void bind();
     void update(float deltaTime);
 };
 
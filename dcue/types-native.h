@@ -23,13 +23,21 @@ namespace native {
         RGBAf emission;
         texture_t* texture;
         uint8_t mode;
+        // compiled once by compileMaterialHeaders, [0] culls CCW and [1] CW
+        // call it again after changing texture or mode
+        pvr_poly_hdr_t hdr[2];
     };
 
     struct mesh_t {
         Sphere bounding_sphere;
-        uint8_t* quadData;
+        union {
+            uint8_t* quadData;
+            uint32_t quadDataOffset;    // in the scene file, relative to the mesh_t. Turned into quadData on load
+            uint64_t quadDataPad;       // same layout on 32 and 64 bit
+        };
         uint8_t data[0];
     };
+    static_assert(sizeof(mesh_t) == 24);
 
     struct r_vector3_t {
         union {
@@ -104,9 +112,23 @@ namespace native {
         goi_inactive_parent = 2,
         goi_mask = 3,
 
-        go_movable = 4
+        go_movable = 4,
+        go_transform_dirty = 8,
+        go_static = 16,             // transform unchanged since load, same for all parents
+        go_static_bvh = 32,         // listed in the scene's static bvh
+        go_dynamic_subtree = 64     // self or a child is culled through the hierarchy instead of the bvh
     };
 
+    // static bvh, flattened in depth first order. A culled node continues at skip
+    struct static_bvh_node_t {
+        Sphere bounds;
+        uint32_t skip;
+        uint16_t objectCount;   // 0 for inner nodes
+        uint16_t pad;
+        uint32_t firstObject;   // index in the bvh game object list
+    };
+    static_assert(sizeof(static_bvh_node_t) == 28);
+
     
     struct animated_light_t {
         point_light_t* light;
@@ -121,14 +143,13 @@ namespace native {
         game_object_t* parent;
         size_t* children;
         component_t* components;
+        uint32_t componentMask;     // bit per componentSlot present in components
         unsigned ltw_stamp;
-        Sphere compoundSphere;
         Sphere meshSphere;
         float maxWorldScale;
-        bool compoundVisible;
 
         mesh_t* mesh;
-        int8_t** bakedColors;
+        uint16_t** bakedColors;     // RGB565 per vertex, submesh * meshLodLevels + lod
         animated_light_t*** partiallyBakedColors;
         material_t** materials;
         size_t submesh_count;
@@ -136,23 +157,32 @@ namespace native {
         /*game_object_inactive_t*/ unsigned flags;
         bool mesh_enabled;
 
-        bool isActive() const;
+        // goi_inactive_parent is kept up to date by setActive/computeActiveState
+        bool isActive() const { return !(flags & goi_mask); }
+
+        // position/rotation/scale/parent changed, positionUpdate recomputes ltw & meshSphere
+        // children follow through ltw_stamp. The object (and its children) leave the static bvh
+        void markTransformDirty() { flags = (flags & ~go_static) | go_transform_dirty; }
+        // mesh_enabled changed, only meshSphere needs an update
+        void markMeshDirty() { flags |= go_transform_dirty; }
+
+        bool inStaticBvh() const { return (flags & (go_static | go_static_bvh)) == (go_static | go_static_bvh); }
 
         void setActive(bool active);
         void computeActiveState();
 
+        // sorts the list by componentSlot and fills in componentMask
+        void setComponents(component_t* componentList);
+
         template<typename T>
         T** getComponents() {
-            auto componentList = components;
-            while (componentList->componentType != ct_eol) {
-                auto componentType = componentList->componentType;
-                componentList++;
-                if (componentType == T::componentType) {
-                    return (T**)componentList->data;
-                }
-                componentList++;
+            constexpr uint32_t bit = 1u << componentSlot(T::componentType);
+            if (!(componentMask & bit)) {
+                return nullptr;
             }
-            return nullptr;
+            // entries are sorted by slot, so the index is the number of lower slots present
+            auto index = __builtin_popcount(componentMask & (bit - 1));
+            return (T**)components[index * 2 + 1].data;
         }
 
         template<typename T>
@@ -165,6 +195,10 @@ namespace native {
         }
     };
 
+    // mesh data starts with meshLodLevels MeshInfo per submesh, finest first
+    // a level that didn't simplify well points at the same meshlets as the level before it
+    constexpr unsigned meshLodLevels = 3;
+
     struct MeshInfo {
         int16_t meshletCount;
         int16_t meshletOffset;
@@ -180,8 +214,97 @@ namespace native {
         uint16_t indexCount;
         uint32_t vertexOffset;
         uint32_t indexOffset;
+        // normal cone, snorm8. The meshlet faces away when
+        // dot(center - eye, coneAxis) >= coneCutoff * length(center - eye) + radius. 127 never culls
+        int8_t coneAxis[3];
+        int8_t coneCutoff;
         uint32_t skinIndexOffset;
         uint32_t skinWeightOffset;
     };
-    static_assert(sizeof(MeshletInfo) == 40); // or 32 if !skin
+    static_assert(sizeof(MeshletInfo) == 44); // or 36 if !skin
+
+    // scene file (DCUENS09): header, section table, then sections aligned to sceneSectionAlignment
+    // each section is read with a single read
+    constexpr uint32_t sceneSectionAlignment = 32;
+
+    enum scene_section_t {
+        ss_textures,            // uint32_t count, scene_texture_t[count], then texture data
+        ss_materials,           // scene_material_t[]
+        ss_meshes,              // uint32_t count, uint32_t offset[count], then mesh_t + data + quadData per mesh
+        ss_game_objects,        // scene_game_object_t[]
+        ss_game_object_materials, // uint32_t material index, scene_game_object_t::firstMaterial points here
+        ss_skybox,              // scene_skybox_t
+        ss_static_bvh_nodes,    // static_bvh_node_t[]
+        ss_static_bvh_objects,  // uint32_t game object index
+        ss_count
+    };
+
+    struct scene_section_header_t {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct scene_texture_t {
+        uint32_t size;
+        uint32_t dataOffset;    // relative to the section
+        uint32_t flags;
+        uint32_t offs;
+        uint8_t lw;
+        uint8_t lh;
+        uint8_t pad[2];
+    };
+    static_assert(sizeof(scene_texture_t) == 20);
+
+    struct scene_material_t {
+        RGBAf color;
+        RGBAf emission;
+        uint32_t texture;       // UINT32_MAX for none
+        uint8_t mode;
+        uint8_t pad[3];
+    };
+    static_assert(sizeof(scene_material_t) == 40);
+
+    struct scene_game_object_t {
+        r_matrix_t ltw;
+        uint32_t mesh;          // UINT32_MAX for none
+        uint32_t submeshCount;
+        uint32_t firstMaterial;
+        uint8_t active;
+        uint8_t movable;
+        uint8_t mesh_enabled;
+        uint8_t pad;
+    };
+    static_assert(sizeof(scene_game_object_t) == 80);
+
+    // baked lighting file (DCUEBL03), written by tlj-sim.elf --bake-lights, read whole at boot
+    // baked_lighting_header_t, then per baked game object a baked_object_header_t followed by
+    //   uint32_t colorsOffset[bakeCount], uint16_t colors[colorsSize] (RGB565) padded to 4
+    //   with partialBakes, per bake entry that isn't a lod alias and per meshlet:
+    //   uint32_t vertexCount, uint32_t lightCount,
+    //   lightCount * (uint32_t point_lights index, int8_t intensities[vertexCount] padded to 4)
+    // bake entries are submesh * meshLodLevels + lod
+    // sceneHash and lightsHash cover the scene file and the point light parameters the bake read
+    struct baked_lighting_header_t {
+        char magic[8];
+        uint32_t gameObjectCount;
+        uint32_t pointLightCount;
+        uint32_t objectCount;
+        uint32_t sceneHash;
+        uint32_t lightsHash;
+    };
+    static_assert(sizeof(baked_lighting_header_t) == 28);
+
+    struct baked_object_header_t {
+        uint32_t gameObject;
+        uint32_t bakeCount;
+        uint32_t colorsSize;
+        uint32_t partialBakes;
+    };
+    static_assert(sizeof(baked_object_header_t) == 16);
+
+    struct scene_skybox_t {
+        uint32_t textures[6];
+        RGBAf tint;
+    };
+    static_assert(sizeof(scene_skybox_t) == 40);
 }
\ No newline at end of file
@@ -17,6 +17,7 @@
 #include <cassert>
 #include <cstring>
 #include <chrono>
+#include <malloc.h>
 #include <map>
 
 #include "components.h"
@@ -37,6 +38,10 @@
 #if defined(DC_SIM)
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "vendor/stb/stb_image_write.h"
+#include "emu/emu.h"
+#include <set>
+#include <string>
+#include <filesystem>
 #endif
 
 float timeDeltaTime;
@@ -286,6 +291,8 @@ std::vector<material_t*> materials;
 std::vector<material_t**> material_groups;
 std::vector<mesh_t*> meshes;
 std::vector<game_object_t*> gameObjects;
+std::vector<static_bvh_node_t> staticBvhNodes;
+std::vector<uint32_t> staticBvhObjects;
 
 texture_t* skybox[6];
 RGBAf skyboxTint;
@@ -333,26 +340,41 @@ void load_pvr(const char *fname, texture_t* texture) {
             break;
     }
 
-    uint8_t temp[2048];
-    
-    size_t remaining = HDR.nTextureDataSize - 16;
-    texture->data = (pvr_ptr_t)alloc_malloc(&texture->data, remaining);
-    uintptr_t dst = (uintptr_t)texture->data;
-
-    while (remaining > 0) {
-        size_t to_read = remaining < sizeof(temp) ? remaining : sizeof(temp);
-        assert(fread(temp, 1, to_read, tex) == to_read);
-        
-        memcpy((void*)dst, temp, to_read);
-        remaining -= to_read;
-        dst += to_read;
-    }
+    // one read into main ram, then copy to vram
+    size_t size = HDR.nTextureDataSize - 16;
+    texture->data = (pvr_ptr_t)alloc_malloc(&texture->data, size);
+    auto temp = malloc(size);
+    auto readSize = fread(temp, 1, size, tex);
+    assert(readSize == size);
+    (void)readSize;
+    memcpy(texture->data, temp, size);
+    free(temp);
 
     texture->lw = __builtin_ctz(HDR.nWidth) - 3;
     texture->lh = __builtin_ctz(HDR.nHeight) - 3;
 	fclose(tex);
 }
 
+// FNV-1a, chained by passing the previous hash back in
+static uint32_t fnv1a(const void* data, size_t size, uint32_t hash = 2166136261u) {
+	auto bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// hash of every section loadScene read as stored in the file, so everything but the texture data.
+// The baked lighting records it to notice a scene that was repacked after the bake
+static uint32_t sceneHash;
+
+// reads a whole section into buffer, which must hold header.size bytes
+static void readSection(std::ifstream& in, const scene_section_header_t& header, void* buffer) {
+	in.seekg(header.offset);
+	in.read(reinterpret_cast<char*>(buffer), header.size);
+	sceneHash = fnv1a(buffer, header.size, sceneHash);
+}
+
 bool loadScene(const char* scene) {
     std::ifstream in(scene, std::ios::binary);
     if (!in) {
@@ -363,128 +385,169 @@ bool loadScene(const char* scene) {
     // Read and verify header (8 bytes)
     char header[9] = { 0};
     in.read(header, 8);
-    if (strncmp(header, "DCUENS05", 8) != 0) {
+    if (strncmp(header, "DCUENS09", 8) != 0) {
         std::cout << "Invalid file header: " << header << std::endl;
         return false;
     }
 
-    uint32_t tmp;
-
-    // Read textures
-    uint32_t textureCount;
-    in.read(reinterpret_cast<char*>(&textureCount), sizeof(textureCount));
-    textures.resize(textureCount);
-    for (uint32_t i = 0; i < textureCount; ++i) {
-        auto tex = textures[i] = new texture_t();
-        in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-        tex->data = alloc_malloc(&tex->data, tmp);
-        in.read((char*)&tex->flags, sizeof(tex->flags));
-		in.read((char*)&tex->offs, sizeof(tex->offs));
-		in.read((char*)&tex->lw, sizeof(tex->lw));
-		in.read((char*)&tex->lh, sizeof(tex->lh));
-        in.read(reinterpret_cast<char*>(tex->data), tmp);
-    }
+	uint32_t sectionCount;
+	in.read(reinterpret_cast<char*>(&sectionCount), sizeof(sectionCount));
+	if (sectionCount != ss_count) {
+		std::cout << "Unexpected section count: " << sectionCount << std::endl;
+		return false;
+	}
+	scene_section_header_t sections[ss_count];
+	in.read(reinterpret_cast<char*>(sections), sizeof(sections));
+	sceneHash = fnv1a(sections, sizeof(sections));
 
-    // Read materials
-    uint32_t materialCount;
-    in.read(reinterpret_cast<char*>(&materialCount), sizeof(materialCount));
-    materials.resize(materialCount);
-    for (uint32_t i = 0; i < materialCount; ++i) {
-        auto material = materials[i] = new material_t();
+    // Textures, streamed to vram one at a time through a buffer sized to the largest,
+    // so the section is never held in main ram as a whole
+	{
+		auto& section = sections[ss_textures];
+		uint32_t textureCount;
+		in.seekg(section.offset);
+		in.read(reinterpret_cast<char*>(&textureCount), sizeof(textureCount));
+		auto sceneTextures = new scene_texture_t[textureCount];
+		in.read(reinterpret_cast<char*>(sceneTextures), textureCount * sizeof(scene_texture_t));
+
+		uint32_t largestTexture = 0;
+		for (size_t i = 0; i < textureCount; ++i) {
+			largestTexture = std::max(largestTexture, sceneTextures[i].size);
+		}
+		auto staging = malloc(largestTexture);
+
+		auto textureArray = new texture_t[textureCount];
+		textures.resize(textureCount);
+		for (size_t i = 0; i < textureCount; ++i) {
+			auto tex = textures[i] = &textureArray[i];
+			tex->data = alloc_malloc(&tex->data, sceneTextures[i].size);
+			tex->flags = sceneTextures[i].flags;
+			tex->offs = sceneTextures[i].offs;
+			tex->lw = sceneTextures[i].lw;
+			tex->lh = sceneTextures[i].lh;
+			in.seekg(section.offset + sceneTextures[i].dataOffset);
+			in.read(reinterpret_cast<char*>(staging), sceneTextures[i].size);
+			memcpy(tex->data, staging, sceneTextures[i].size);
+		}
+		free(staging);
+		delete[] sceneTextures;
+	}
 
-		in.read((char*)&material->mode, sizeof(material->mode));
+    // Materials
+	{
+		auto& section = sections[ss_materials];
+		size_t materialCount = section.size / sizeof(scene_material_t);
+		auto sceneMaterials = new scene_material_t[materialCount];
+		readSection(in, section, sceneMaterials);
+
+		auto materialArray = new material_t[materialCount];
+		materials.resize(materialCount);
+		for (size_t i = 0; i < materialCount; ++i) {
+			auto material = materials[i] = &materialArray[i];
+			material->mode = sceneMaterials[i].mode;
+			material->color = sceneMaterials[i].color;
+			material->emission = sceneMaterials[i].emission;
+			if (sceneMaterials[i].texture != UINT32_MAX) {
+				assert(sceneMaterials[i].texture < textures.size());
+				material->texture = textures[sceneMaterials[i].texture];
+			} else {
+				material->texture = nullptr;
+			}
+		}
+		delete[] sceneMaterials;
+	}
 
-        in.read((char*)&material->color.alpha, sizeof(material->color.alpha));
-		in.read((char*)&material->color.red, sizeof(material->color.red));
-		in.read((char*)&material->color.green, sizeof(material->color.green));
-		in.read((char*)&material->color.blue, sizeof(material->color.blue));
+    // Meshes, used in place
+	{
+		auto& section = sections[ss_meshes];
+		auto sectionData = (uint8_t*)memalign(sceneSectionAlignment, section.size);
+		readSection(in, section, sectionData);
+
+		auto meshCount = *(uint32_t*)sectionData;
+		auto meshOffsets = (uint32_t*)sectionData + 1;
+		meshes.resize(meshCount);
+		for (uint32_t i = 0; i < meshCount; ++i) {
+			auto mesh = meshes[i] = (mesh_t*)(sectionData + meshOffsets[i]);
+			mesh->quadData = (uint8_t*)mesh + mesh->quadDataOffset;
+		}
+	}
 
-		in.read((char*)&material->emission.alpha, sizeof(material->emission.alpha));
-		in.read((char*)&material->emission.red, sizeof(material->emission.red));
-		in.read((char*)&material->emission.green, sizeof(material->emission.green));
-		in.read((char*)&material->emission.blue, sizeof(material->emission.blue));
-        
-        in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-        if (tmp != UINT32_MAX) {
-            assert(tmp < textures.size());
-            material->texture = textures[tmp];
-        } else {
-            material->texture = nullptr;
-        }
-    }
+    // Game objects
+	{
+		auto& section = sections[ss_game_objects];
+		size_t gameObjectCount = section.size / sizeof(scene_game_object_t);
+		auto sceneGameObjects = new scene_game_object_t[gameObjectCount];
+		readSection(in, section, sceneGameObjects);
+
+		auto& materialsSection = sections[ss_game_object_materials];
+		auto materialArray = new material_t*[materialsSection.size / sizeof(uint32_t)];
+		material_groups.push_back(materialArray);
+		auto materialIndices = (uint32_t*)materialArray;
+		readSection(in, materialsSection, materialIndices);
+		// pointers are at least as wide as the indices, convert back to front
+		for (size_t i = materialsSection.size / sizeof(uint32_t); i-- > 0; ) {
+			auto materialIndex = materialIndices[i];
+			if (materialIndex != UINT32_MAX) {
+				assert(materialIndex < materials.size());
+				materialArray[i] = materials[materialIndex];
+			} else {
+				materialArray[i] = nullptr;
+			}
+		}
 
-    // Read meshes
-    uint32_t meshCount;
-    in.read(reinterpret_cast<char*>(&meshCount), sizeof(meshCount));
-    meshes.resize(meshCount);
-    for (uint32_t i = 0; i < meshCount; ++i) {
-		uint32_t quadDataSize;
-		in.read(reinterpret_cast<char*>(&quadDataSize), sizeof(quadDataSize));
-        in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-        auto mesh = meshes[i] = (mesh_t*)malloc(sizeof(mesh_t) + tmp);
-        in.read((char*)&mesh->bounding_sphere, sizeof(mesh->bounding_sphere));
-		mesh->quadData = (uint8_t*)malloc(quadDataSize);
-		in.read(reinterpret_cast<char*>(mesh->quadData), quadDataSize);
-        in.read(reinterpret_cast<char*>(mesh->data), tmp);
-    }
+		auto gameObjectArray = new game_object_t[gameObjectCount]();
+		gameObjects.resize(gameObjectCount);
+		for (size_t i = 0; i < gameObjectCount; ++i) {
+			auto& sceneGameObject = sceneGameObjects[i];
+			auto go = gameObjects[i] = &gameObjectArray[i];
+			if (!sceneGameObject.active) {
+				go->flags = goi_inactive;
+			}
+			if (sceneGameObject.movable) {
+				go->flags |= go_movable;
+			} else {
+				go->flags |= go_static;
+			}
+			go->flags |= go_transform_dirty;
 
-    // Read game objects
-    uint32_t gameObjectCount;
-    in.read(reinterpret_cast<char*>(&gameObjectCount), sizeof(gameObjectCount));
-    gameObjects.resize(gameObjectCount);
-    for (uint32_t i = 0; i < gameObjectCount; ++i) {
-        auto go = gameObjects[i] = new game_object_t();
-		bool active;
-        in.read((char*)&active, sizeof(active));
-		if (!active) {
-			go->flags = goi_inactive;
-		}
-		bool movable;
-        in.read((char*)&movable, sizeof(movable));
-		if (movable) {
-			go->flags |= go_movable;
-		}
-
-        in.read(reinterpret_cast<char*>(&go->ltw.m00), 16 * sizeof(float));
-        in.read((char*)&go->mesh_enabled, sizeof(go->mesh_enabled));
-
-        in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-        if (tmp != UINT32_MAX) {
-            assert(tmp < meshes.size());
-            go->mesh = meshes[tmp];
-        } else {
-            go->mesh = nullptr;
-        }
-        in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-        auto submesh_count = tmp;
-        if (submesh_count != 0) {
-            auto materials_group = new material_t*[submesh_count];
-            material_groups.push_back(materials_group);
-            go->materials = materials_group;
-            for (uint32_t materialNum = 0; materialNum < submesh_count; materialNum++) {
-                in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-                if (tmp != UINT32_MAX) {
-                    assert(tmp < materials.size());
-                    go->materials[materialNum] = materials[tmp];
-                } else {
-                    go->materials[materialNum] = nullptr;
-                }
-            }
-        } else {
-            go->materials = nullptr;
-        }
-        go->submesh_count = submesh_count;
-    }
+			go->ltw = sceneGameObject.ltw;
+			go->mesh_enabled = sceneGameObject.mesh_enabled;
+
+			if (sceneGameObject.mesh != UINT32_MAX) {
+				assert(sceneGameObject.mesh < meshes.size());
+				go->mesh = meshes[sceneGameObject.mesh];
+			} else {
+				go->mesh = nullptr;
+			}
+			if (sceneGameObject.submeshCount != 0) {
+				go->materials = &materialArray[sceneGameObject.firstMaterial];
+			} else {
+				go->materials = nullptr;
+			}
+			go->submesh_count = sceneGameObject.submeshCount;
+		}
+		delete[] sceneGameObjects;
+	}
 
-	for (int i = 0; i < 6; i++) {
-		in.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-		skybox[i] = textures[tmp];
+	{
+		scene_skybox_t sceneSkybox;
+		assert(sections[ss_skybox].size == sizeof(sceneSkybox));
+		readSection(in, sections[ss_skybox], &sceneSkybox);
+		for (int i = 0; i < 6; i++) {
+			skybox[i] = textures[sceneSkybox.textures[i]];
+		}
+		skyboxTint = sceneSkybox.tint;
 	}
 
-	in.read(reinterpret_cast<char*>(&skyboxTint.alpha), sizeof(skyboxTint.alpha));
-	in.read(reinterpret_cast<char*>(&skyboxTint.red), sizeof(skyboxTint.red));
-	in.read(reinterpret_cast<char*>(&skyboxTint.green), sizeof(skyboxTint.green));
-	in.read(reinterpret_cast<char*>(&skyboxTint.blue), sizeof(skyboxTint.blue));
+	// Static bvh
+	staticBvhNodes.resize(sections[ss_static_bvh_nodes].size / sizeof(static_bvh_node_t));
+	readSection(in, sections[ss_static_bvh_nodes], staticBvhNodes.data());
+	staticBvhObjects.resize(sections[ss_static_bvh_objects].size / sizeof(uint32_t));
+	readSection(in, sections[ss_static_bvh_objects], staticBvhObjects.data());
+	for (auto gameObjectIndex: staticBvhObjects) {
+		assert(gameObjectIndex < gameObjects.size());
+		gameObjects[gameObjectIndex]->flags |= go_static_bvh;
+	}
 
 	assert(!in.bad());
     in.close();
@@ -495,6 +558,180 @@ bool loadScene(const char* scene) {
     return true;
 }
 
+#if defined(DC_SIM)
+// tlj-sim.elf --check-scene: validates the section table and every offset in the scene
+// file without trusting it, then loads it and compares what loadScene left in memory
+static bool checkScene(const char* scene) {
+	std::ifstream in(scene, std::ios::binary);
+	if (!in) {
+		std::cout << "Failed to open file: " << scene << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	bool ok = true;
+	auto fail = [&ok](const std::string& message) {
+		std::cout << "check-scene: " << message << std::endl;
+		ok = false;
+	};
+
+	size_t tableEnd = 8 + sizeof(uint32_t) + ss_count * sizeof(scene_section_header_t);
+	if (file.size() < tableEnd || memcmp(file.data(), "DCUENS09", 8) != 0 || *(uint32_t*)&file[8] != ss_count) {
+		fail("bad header or section count");
+		return false;
+	}
+
+	auto sections = (scene_section_header_t*)&file[12];
+	uint64_t previousEnd = tableEnd;
+	for (unsigned i = 0; i < ss_count; i++) {
+		if (sections[i].offset % sceneSectionAlignment) {
+			fail("section " + std::to_string(i) + " is not aligned");
+		}
+		if (sections[i].offset < previousEnd || (uint64_t)sections[i].offset + sections[i].size > file.size()) {
+			fail("section " + std::to_string(i) + " overlaps or runs past the end of the file");
+		}
+		previousEnd = (uint64_t)sections[i].offset + sections[i].size;
+	}
+	if (!ok) {
+		return false;
+	}
+	auto sectionData = [&](unsigned section) { return &file[sections[section].offset]; };
+
+	// textures
+	auto& texturesSection = sections[ss_textures];
+	uint32_t textureCount = texturesSection.size >= sizeof(uint32_t) ? *(uint32_t*)sectionData(ss_textures) : 0;
+	auto sceneTextures = (scene_texture_t*)(sectionData(ss_textures) + sizeof(uint32_t));
+	uint64_t textureTableEnd = sizeof(uint32_t) + (uint64_t)textureCount * sizeof(scene_texture_t);
+	if (textureTableEnd > texturesSection.size) {
+		fail("texture table runs past its section");
+		return false;
+	}
+	for (uint32_t i = 0; i < textureCount; i++) {
+		if (sceneTextures[i].dataOffset < textureTableEnd || (uint64_t)sceneTextures[i].dataOffset + sceneTextures[i].size > texturesSection.size) {
+			fail("texture " + std::to_string(i) + " data is outside its section");
+		}
+	}
+
+	// materials
+	size_t materialCount = sections[ss_materials].size / sizeof(scene_material_t);
+	auto sceneMaterials = (scene_material_t*)sectionData(ss_materials);
+	for (size_t i = 0; i < materialCount; i++) {
+		if (sceneMaterials[i].texture != UINT32_MAX && sceneMaterials[i].texture >= textureCount) {
+			fail("material " + std::to_string(i) + " has a bad texture index");
+		}
+	}
+
+	// meshes, each runs up to the next one or the end of the section
+	auto& meshesSection = sections[ss_meshes];
+	uint32_t meshCount = meshesSection.size >= sizeof(uint32_t) ? *(uint32_t*)sectionData(ss_meshes) : 0;
+	auto meshOffsets = (uint32_t*)sectionData(ss_meshes) + 1;
+	uint64_t meshTableEnd = sizeof(uint32_t) * (1 + (uint64_t)meshCount);
+	if (meshTableEnd > meshesSection.size) {
+		fail("mesh table runs past its section");
+		return false;
+	}
+	std::vector<uint32_t> meshSizes(meshCount);
+	for (uint32_t i = 0; i < meshCount; i++) {
+		uint32_t meshEnd = i + 1 < meshCount ? meshOffsets[i + 1] : meshesSection.size;
+		if (meshOffsets[i] < meshTableEnd || meshOffsets[i] % 8 || meshEnd > meshesSection.size || meshOffsets[i] + sizeof(mesh_t) > meshEnd) {
+			fail("mesh " + std::to_string(i) + " is outside its section");
+			continue;
+		}
+		meshSizes[i] = meshEnd - meshOffsets[i];
+		auto mesh = (mesh_t*)(sectionData(ss_meshes) + meshOffsets[i]);
+		if (mesh->quadDataOffset < sizeof(mesh_t) || mesh->quadDataOffset > meshSizes[i]) {
+			fail("mesh " + std::to_string(i) + " quadData is outside the mesh");
+		}
+	}
+
+	// game objects and their material groups
+	size_t gameObjectCount = sections[ss_game_objects].size / sizeof(scene_game_object_t);
+	auto sceneGameObjects = (scene_game_object_t*)sectionData(ss_game_objects);
+	size_t materialIndexCount = sections[ss_game_object_materials].size / sizeof(uint32_t);
+	auto materialIndices = (uint32_t*)sectionData(ss_game_object_materials);
+	for (size_t i = 0; i < materialIndexCount; i++) {
+		if (materialIndices[i] != UINT32_MAX && materialIndices[i] >= materialCount) {
+			fail("material group entry " + std::to_string(i) + " has a bad material index");
+		}
+	}
+	for (size_t i = 0; i < gameObjectCount; i++) {
+		auto& go = sceneGameObjects[i];
+		if (go.mesh != UINT32_MAX && go.mesh >= meshCount) {
+			fail("game object " + std::to_string(i) + " has a bad mesh index");
+		}
+		if (go.submeshCount && (uint64_t)go.firstMaterial + go.submeshCount > materialIndexCount) {
+			fail("game object " + std::to_string(i) + " materials run past the material groups");
+		}
+	}
+
+	if (sections[ss_skybox].size != sizeof(scene_skybox_t)) {
+		fail("skybox section has the wrong size");
+	} else {
+		auto sceneSkybox = (scene_skybox_t*)sectionData(ss_skybox);
+		for (int i = 0; i < 6; i++) {
+			if (sceneSkybox->textures[i] >= textureCount) {
+				fail("skybox has a bad texture index");
+			}
+		}
+	}
+
+	auto bvhObjects = (uint32_t*)sectionData(ss_static_bvh_objects);
+	for (size_t i = 0; i < sections[ss_static_bvh_objects].size / sizeof(uint32_t); i++) {
+		if (bvhObjects[i] >= gameObjectCount) {
+			fail("static bvh has a bad game object index");
+		}
+	}
+
+	if (!ok) {
+		return false;
+	}
+
+	// now load it and compare
+	if (!loadScene(scene)) {
+		fail("loadScene failed");
+		return false;
+	}
+	if (textures.size() != textureCount || materials.size() != materialCount || meshes.size() != meshCount || gameObjects.size() != gameObjectCount) {
+		fail("loaded counts don't match the file");
+		return false;
+	}
+	for (uint32_t i = 0; i < textureCount; i++) {
+		if (memcmp(textures[i]->data, sectionData(ss_textures) + sceneTextures[i].dataOffset, sceneTextures[i].size) != 0) {
+			fail("texture " + std::to_string(i) + " differs in vram");
+		}
+	}
+	for (uint32_t i = 0; i < meshCount; i++) {
+		auto fileMesh = (mesh_t*)(sectionData(ss_meshes) + meshOffsets[i]);
+		if (meshes[i]->quadData != (uint8_t*)meshes[i] + fileMesh->quadDataOffset) {
+			fail("mesh " + std::to_string(i) + " quadData fixup is wrong");
+		}
+		if (memcmp(meshes[i]->data, fileMesh->data, meshSizes[i] - sizeof(mesh_t)) != 0) {
+			fail("mesh " + std::to_string(i) + " data differs");
+		}
+	}
+	for (size_t i = 0; i < gameObjectCount; i++) {
+		auto& go = sceneGameObjects[i];
+		auto expectedMesh = go.mesh != UINT32_MAX ? meshes[go.mesh] : nullptr;
+		if (gameObjects[i]->mesh != expectedMesh || gameObjects[i]->submesh_count != go.submeshCount) {
+			fail("game object " + std::to_string(i) + " was loaded wrong");
+			continue;
+		}
+		for (uint32_t j = 0; j < go.submeshCount; j++) {
+			auto index = materialIndices[go.firstMaterial + j];
+			if (gameObjects[i]->materials[j] != (index != UINT32_MAX ? materials[index] : nullptr)) {
+				fail("game object " + std::to_string(i) + " has the wrong material");
+			}
+		}
+	}
+
+	if (ok) {
+		std::cout << "check-scene: " << textureCount << " textures, " << materialCount << " materials, "
+			<< meshCount << " meshes and " << gameObjectCount << " game objects OK" << std::endl;
+	}
+	return ok;
+}
+#endif
+
 matrix_t DCE_MESHLET_MAT_DECODE = {
 	{ 1.0f/256, 0.0f, 0.0f, 0.0f},
 	{ 0.0f, 1.0f/256, 0.0f, 0.0f},
@@ -530,6 +767,18 @@ void dce_set_mat_vertex_color(const RGBAf* residual, const RGBAf* material) {
 	DCE_MESHLET_MAT_VERTEX_COLOR[3][3] = residual->alpha;
 }
 
+// for RGB565 baked colors, no signed offset and the 5/6 bit fields scaled back to 0..255
+void dce_set_mat_vertex_color_baked(const RGBAf* residual, const RGBAf* material) {
+	DCE_MESHLET_MAT_VERTEX_COLOR[0][0] = material->blue * (255.0f / 31);
+	DCE_MESHLET_MAT_VERTEX_COLOR[1][1] = material->green * (255.0f / 63);
+	DCE_MESHLET_MAT_VERTEX_COLOR[2][2] = material->red * (255.0f / 31);
+
+	DCE_MESHLET_MAT_VERTEX_COLOR[3][0] = residual->blue;
+	DCE_MESHLET_MAT_VERTEX_COLOR[3][1] = residual->green;
+	DCE_MESHLET_MAT_VERTEX_COLOR[3][2] = residual->red;
+	DCE_MESHLET_MAT_VERTEX_COLOR[3][3] = residual->alpha;
+}
+
 void dce_set_mat_vertex_color_light(const point_light_t* light, const RGBAf* material) {
 	DCE_MESHLET_MAT_VERTEX_COLOR[0][0] = light->color.blue * light->intensity * material->blue;
 	DCE_MESHLET_MAT_VERTEX_COLOR[1][1] = light->color.green * light->intensity * material->green;
@@ -1149,38 +1398,37 @@ __attribute__ ((noinline)) void tnlMeshletVertexColor(uint8_t* dstCol, const int
 }
 #endif
 
-__attribute__ ((noinline)) void tnlMeshletVertexColorBaked(uint8_t* dstCol, const int8_t* colData, uint32_t vertexCount) {
-	const int8_t* next_vertex = colData;
+// colData is RGB565, DCE_MESHLET_MAT_VERTEX_COLOR from dce_set_mat_vertex_color_baked scales the fields back up
+__attribute__ ((noinline)) void tnlMeshletVertexColorBaked(uint8_t* dstCol, const uint16_t* colData, uint32_t vertexCount) {
+	const uint16_t* next_vertex = colData;
 	// should be already in cache
 	// dcache_pref_block(next_vertex);
 
-	auto vertex = next_vertex;
-	next_vertex += 3;
-	float cB = *vertex++;
-	float cG = *vertex++;
-	float cR = *vertex++;
+	unsigned packed = *next_vertex++;
+	float cB = packed & 31;
+	float cG = (packed >> 5) & 63;
+	float cR = packed >> 11;
 	float cA;
 
 	vertexCount--;
 
 	dstCol += 4 * sizeof(float);
 	do {
-		vertex = next_vertex;
 		// should be alraedy in cache
-		// dcache_pref_block(vertex + 32);
+		// dcache_pref_block(next_vertex + 16);
 
-		next_vertex += 3;
+		packed = *next_vertex++;
 
 		float* cols = (float*)dstCol;
 		
 		mat_trans_nodiv_nomod(cB, cG, cR, cB, cG, cR, cA);
 
 		*--cols = cB;
-		cB = *vertex++;
+		cB = packed & 31;
 		*--cols = cG;
-		cG = *vertex++;
+		cG = (packed >> 5) & 63;
 		*--cols = cR;
-		cR = *vertex++;
+		cR = packed >> 11;
 		*--cols = cA;
 		
 		dstCol += 64;
@@ -2290,7 +2538,7 @@ static constexpr void (*tnlMeshletVertexColorSelector[1])(uint8_t* dstCol, const
 	&tnlMeshletVertexColor,
 };
 
-static constexpr void (*tnlMeshletVertexColorBakedSelector[1])(uint8_t* dstCol, const int8_t* colData, uint32_t vertexCount) = {
+static constexpr void (*tnlMeshletVertexColorBakedSelector[1])(uint8_t* dstCol, const uint16_t* colData, uint32_t vertexCount) = {
 	&tnlMeshletVertexColorBaked,
 };
 
@@ -2422,35 +2670,179 @@ game_object_t* pointedGameObject = nullptr;
 #endif
 
 static float zBuffer[32][32];
+
+// occluder quads rasterized into zBuffer per frame, largest on screen first
+unsigned occluderQuadBudget = 256;
+
+// farthest depth pyramid over zBuffer, each level keeps the min of the 2x2 cells below it
+// so a passing coarse cell means every cell it covers passes
+constexpr unsigned zPyramidLevels = 4; // 32, 16, 8, 4
+static float zPyramid1[16][16];
+static float zPyramid2[8][8];
+static float zPyramid3[4][4];
+static float* const zPyramid[zPyramidLevels] = { &zBuffer[0][0], &zPyramid1[0][0], &zPyramid2[0][0], &zPyramid3[0][0] };
+
+// after the occluders are in zBuffer
+void buildZPyramid() {
+	for (unsigned level = 1; level < zPyramidLevels; level++) {
+		unsigned size = 32 >> level;
+		const float* src = zPyramid[level - 1];
+		float* dst = zPyramid[level];
+		for (unsigned y = 0; y < size; y++) {
+			for (unsigned x = 0; x < size; x++) {
+				const float* cell = &src[y * 2 * size * 2 + x * 2];
+				dst[y * size + x] = std::min(std::min(cell[0], cell[1]), std::min(cell[size * 2], cell[size * 2 + 1]));
+			}
+		}
+	}
+}
+
+// true if every zBuffer cell of the inclusive rect under pyramid cell x, y is at least maxZ
+static bool zPyramidCovers(unsigned level, unsigned x, unsigned y, unsigned minX, unsigned minY, unsigned maxX, unsigned maxY, float maxZ) {
+	if (zPyramid[level][y * (32 >> level) + x] >= maxZ) {
+		return true;
+	}
+	if (level == 0) {
+		return false;
+	}
+
+	level--;
+	for (unsigned cy = y * 2; cy <= y * 2 + 1; cy++) {
+		if ((cy << level) > maxY || ((cy + 1) << level) <= minY) {
+			continue;
+		}
+		for (unsigned cx = x * 2; cx <= x * 2 + 1; cx++) {
+			if ((cx << level) > maxX || ((cx + 1) << level) <= minX) {
+				continue;
+			}
+			if (!zPyramidCovers(level, cx, cy, minX, minY, maxX, maxY, maxZ)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 #if defined(DC_SIM)
-unsigned total_idx;
+// per frame counters, printed or written to --stats
+struct sim_frame_stats_t {
+	unsigned objectsDrawn;
+	unsigned objectsOccluded;
+	unsigned meshletsDrawn;
+	unsigned meshletsCulled;
+	unsigned meshletsBackfaced;
+	unsigned indices;
+	unsigned occludersDrawn;
+	unsigned occludersSkipped;    // over occluderQuadBudget
+	unsigned occluderQuads;
+	unsigned polyHeaders;
+	unsigned polyHeadersSaved;    // same state as the previous submesh, see lastPolyHeader
+};
+sim_frame_stats_t simStats;
+
+struct sim_options_t {
+	unsigned frames = 0;              // 0 runs forever
+	float fixedDeltaTime = 0;         // 0 uses the wall clock
+	std::set<unsigned> dumpFrames;
+	std::string dumpPrefix = "frame";
+	std::string zbufferFile;          // occlusion zbuffer dump, every frame
+	std::string bakeLightsFile;       // bake lighting to this file and exit
+	bool checkBake = false;           // compare the baked lighting file with bakeLights and exit
+	bool checkScene = false;          // validate and load the scene file, then exit
+	bool checkAudio = false;          // simulate stream refills against channel positions, then exit
+	bool checkAnimations = false;     // compare animation key seeking with the linear walk, then exit
+	FILE* stats = nullptr;
+};
+sim_options_t simOptions;
+
+static void simUsage(const char* argv0) {
+	std::cout << argv0 << " [--headless] [--frames N] [--fixed-dt SECONDS] [--dump-frames N,N,...] [--dump-prefix PATH] [--stats FILE.csv] [--zbuffer FILE.bmp] [--occluder-budget QUADS] [--bake-lights FILE] [--check-bake] [--check-scene] [--check-audio] [--check-animations]" << std::endl;
+}
+
+// paths are resolved before main chdirs to the data directory
+static bool parseSimOptions(int argc, const char** argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--headless") {
+			emu_headless = true;
+			if (simOptions.fixedDeltaTime == 0) {
+				simOptions.fixedDeltaTime = 1.0f / 60;
+			}
+		} else if (arg == "--frames" && hasValue) {
+			simOptions.frames = atoi(argv[++i]);
+		} else if (arg == "--fixed-dt" && hasValue) {
+			simOptions.fixedDeltaTime = atof(argv[++i]);
+		} else if (arg == "--dump-frames" && hasValue) {
+			for (auto frame = strtok((char*)argv[++i], ","); frame; frame = strtok(nullptr, ",")) {
+				simOptions.dumpFrames.insert(atoi(frame));
+			}
+		} else if (arg == "--dump-prefix" && hasValue) {
+			simOptions.dumpPrefix = argv[++i];
+		} else if (arg == "--stats" && hasValue) {
+			simOptions.stats = fopen(argv[++i], "w");
+			if (!simOptions.stats) {
+				std::cout << "Failed to open " << argv[i] << std::endl;
+				return false;
+			}
+			fprintf(simOptions.stats, "frame,delta_time,objects_drawn,objects_occluded,meshlets_drawn,meshlets_culled,meshlets_backfaced,indices,occluders_drawn,occluders_skipped,occluder_quads,poly_headers,poly_headers_saved,ta_bytes,vertex_buffer_used\n");
+		} else if (arg == "--zbuffer" && hasValue) {
+			simOptions.zbufferFile = argv[++i];
+		} else if (arg == "--bake-lights" && hasValue) {
+			simOptions.bakeLightsFile = argv[++i];
+		} else if (arg == "--check-bake") {
+			simOptions.checkBake = true;
+		} else if (arg == "--check-scene") {
+			simOptions.checkScene = true;
+		} else if (arg == "--check-audio") {
+			simOptions.checkAudio = true;
+		} else if (arg == "--check-animations") {
+			simOptions.checkAnimations = true;
+		} else if (arg == "--occluder-budget" && hasValue) {
+			occluderQuadBudget = atoi(argv[++i]);
+		} else {
+			simUsage(argv[0]);
+			return false;
+		}
+	}
+
+	simOptions.dumpPrefix = std::filesystem::absolute(simOptions.dumpPrefix).string();
+	if (!simOptions.zbufferFile.empty()) {
+		simOptions.zbufferFile = std::filesystem::absolute(simOptions.zbufferFile).string();
+	}
+	if (!simOptions.bakeLightsFile.empty()) {
+		simOptions.bakeLightsFile = std::filesystem::absolute(simOptions.bakeLightsFile).string();
+	}
+
+	return true;
+}
 #endif
 
 bool forceDynamicLights = false;
 
-template<int list, int mode>
-void renderMesh(camera_t* cam, game_object_t* go) {
-
-	bool isTransp = list != PVR_LIST_OP_POLY;
+// filled once per frame by buildRenderQueues, shared by the occluder and list passes
+struct render_queue_entry_t {
+	matrix_t mvp;           // devViewProjScreen * ltw
+	game_object_t* go;
+	int8_t frustum;         // frustumTestSphereNear of meshSphere
+	int8_t occluded;        // -1 until the first list pass tests it against zBuffer
+	uint8_t lod;            // selectMeshLod
+	float pixelRadius;      // projected meshSphere radius, ranks occluders
+	uint32_t lightsBegin;   // point lights reaching meshSphere in frameLights, UINT32_MAX until the first list pass
+	uint32_t lightsCount;
+};
 
-    if (vertexBufferFree() < freeVertexTarget) {
-        return;
-    }
-    bool global_needsNoClip = false;
+std::vector<render_queue_entry_t> renderQueueEntries;
+std::vector<point_light_t*> frameLights;
 
-    auto global_visible = cam->frustumTestSphereNear(&go->meshSphere);
-    if (global_visible == camera_t::SPHEREOUTSIDE) {
-        // printf("Outside frustum cull (%f, %f, %f) %f\n", sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius);
-        return;
-    } else if (global_visible == camera_t::SPHEREINSIDE) {
-        global_needsNoClip = true;
-    } else {
-        // printf("Needs local clip (%f, %f, %f) %f\n", sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius);
-    }
+// last header renderMesh submitted in the current list, cmd 0 never matches
+static pvr_poly_hdr_t lastPolyHeader;
+// occluders, OP, PT, TR
+std::vector<render_queue_entry_t*> renderQueues[4];
 
+// box test of the mesh bounding sphere against zBuffer, needs mvp loaded
+bool isOccluded(game_object_t* go) {
 	{
-		mat_load(&cam->devViewProjScreen);
-		mat_apply((matrix_t*)&go->ltw);
 		float cx = go->mesh->bounding_sphere.center.x;
 		float cy = go->mesh->bounding_sphere.center.y;
 		float cz = go->mesh->bounding_sphere.center.z;
@@ -2475,7 +2867,7 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 			mat_trans_nodiv_nomod(v[i*3 + 0], v[i*3 + 1], v[i*3 + 2], v[i*3 + 0], v[i*3 + 1], z, v[i*3 + 2]);
 			(void)z;
 			if (v[i*3 + 0] <= 0) {
-				goto skip_test; // needs clipping let's just skip for now
+				return false; // needs clipping let's just skip for now
 			}
 
 			v[i*3 + 2] = 1/v[i*3 + 2];
@@ -2529,19 +2921,125 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 
 		// std::cout << "RECT: " << iMinX << ", "<< iMinY << " ~ " << iMaxX << ", " << iMaxY << " z=" << maxZ << std::endl;
 
-		for (unsigned y = iMinY; y <= iMaxY; y++) {
-			for (unsigned x = iMinX; x <= iMaxX; x++) {
-				if (zBuffer[y][x] < maxZ) {
-					goto skip_test; // failed test, skip the rest of it
+		// start from the finest level where the rect spans at most 2x2 cells, and only descend
+		// into the cells that don't pass as a whole
+		unsigned level = 0;
+		while (level < zPyramidLevels - 1 && (((iMaxX >> level) - (iMinX >> level)) > 1 || ((iMaxY >> level) - (iMinY >> level)) > 1)) {
+			level++;
+		}
+
+		for (unsigned y = iMinY >> level; y <= iMaxY >> level; y++) {
+			for (unsigned x = iMinX >> level; x <= iMaxX >> level; x++) {
+				if (!zPyramidCovers(level, x, y, iMinX, iMinY, iMaxX, iMaxY, maxZ)) {
+					return false; // failed test, skip the rest of it
 				}
 			}
 		}
 		
 		// std::cout << " occluded" << std::endl;
+		return true;
+	}
+}
+
+// material_t::hdr, after loadScene
+void compileMaterialHeaders(material_t* material) {
+	static constexpr pvr_list_t modeList[] = { PVR_LIST_OP_POLY, PVR_LIST_PT_POLY, PVR_LIST_TR_POLY };
+	assert(material->mode < 3);
+	auto list = modeList[material->mode];
+
+	for (unsigned cull = 0; cull < 2; cull++) {
+		if (material->texture) {
+			pvr_poly_cxt_txr_fast(
+				&material->hdr[cull],
+				list,
+
+				material->texture->flags,
+				material->texture->lw,
+				material->texture->lh,
+				(uint8_t*)material->texture->data - material->texture->offs,
+
+				PVR_FILTER_BILINEAR,
+
+				// flip_u, clamp_u, flip_v, clamp_v,
+				PVR_UVFLIP_NONE,
+				PVR_UVCLAMP_NONE,
+				PVR_UVFLIP_NONE,
+				PVR_UVCLAMP_NONE,
+				PVR_UVFMT_16BIT,
+
+				PVR_CLRFMT_4FLOATS,
+				list != PVR_LIST_OP_POLY ? PVR_BLEND_SRCALPHA : PVR_BLEND_ONE,
+				list != PVR_LIST_OP_POLY ? PVR_BLEND_INVSRCALPHA : PVR_BLEND_ZERO,
+				PVR_DEPTHCMP_GEQUAL,
+				PVR_DEPTHWRITE_ENABLE,
+				cull ? PVR_CULLING_CW : PVR_CULLING_CCW,
+				PVR_FOG_DISABLE
+			);
+		} else {
+			pvr_poly_cxt_col_fast(
+				&material->hdr[cull],
+				list,
+
+				PVR_CLRFMT_4FLOATS,
+				list != PVR_LIST_OP_POLY ? PVR_BLEND_SRCALPHA : PVR_BLEND_ONE,
+				list != PVR_LIST_OP_POLY ? PVR_BLEND_INVSRCALPHA : PVR_BLEND_ZERO,
+				PVR_DEPTHCMP_GEQUAL,
+				PVR_DEPTHWRITE_ENABLE,
+				cull ? PVR_CULLING_CW : PVR_CULLING_CCW,
+				PVR_FOG_DISABLE
+			);
+		}
+	}
+}
+
+template<int list, int mode>
+void renderMesh(camera_t* cam, render_queue_entry_t* entry) {
+	auto go = entry->go;
+
+	bool isTransp = list != PVR_LIST_OP_POLY;
+
+    if (vertexBufferFree() < freeVertexTarget) {
+        return;
+    }
+    bool global_needsNoClip = entry->frustum == camera_t::SPHEREINSIDE;
+
+	if (entry->occluded < 0) {
+		mat_load(&entry->mvp);
+		entry->occluded = isOccluded(go);
+	}
+	if (entry->occluded) {
+		#if defined(DC_SIM)
+		simStats.objectsOccluded++;
+		#endif
 		return;
 	}
-	skip_test:
-	
+
+	#if defined(DC_SIM)
+	simStats.objectsDrawn++;
+	#endif
+
+	// the meshlets only test the point lights that reach the object, gathered once per frame for all list passes.
+	// Static objects only light with the moving lights here, so a list kept across frames wouldn't last long
+	if (entry->lightsBegin == UINT32_MAX) {
+		auto point_light_list = dynamic_point_lights;
+
+		if (forceDynamicLights || (go->flags & go_movable)) {
+			point_light_list = point_lights;
+		}
+
+		entry->lightsBegin = frameLights.size();
+		for (auto point = point_light_list; *point; point++) {
+			if ((*point)->gameObject->isActive()) {
+				float dist = length(sub((*point)->gameObject->ltw.pos, go->meshSphere.center));
+				if (dist < go->meshSphere.radius + (*point)->Range) {
+					frameLights.push_back(*point);
+				}
+			}
+		}
+		entry->lightsCount = frameLights.size() - entry->lightsBegin;
+	}
+	// frameLights only grows in here
+	auto objectLights = frameLights.data() + entry->lightsBegin;
 
     unsigned cntDiffuse;
     r_matrix_t invLtw;
@@ -2552,6 +3050,15 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 
     UniformObject uniformObject;
     mat_load((matrix_t*)&invLtw);
+
+	// camera in mesh space, for the meshlet normal cone test
+	V3d camLocal;
+	{
+		float w;
+		mat_trans_nodiv_nomod(cam->gameObject->ltw.pos.x, cam->gameObject->ltw.pos.y, cam->gameObject->ltw.pos.z, camLocal.x, camLocal.y, camLocal.z, w);
+		(void)w;
+	}
+
 	{
 		unsigned n = 0;
 		for (auto directional = directional_lights; *directional; directional++)
@@ -2584,53 +3091,22 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 		if (go->materials[submesh_num]->mode != mode) {
 			continue;
 		}
-        pvr_poly_hdr_t hdr;
         bool textured = go->materials[submesh_num]->texture != nullptr;
+        auto& hdr = go->materials[submesh_num]->hdr[culling == PVR_CULLING_CW];
 
-        if (go->materials[submesh_num]->texture) {
-            pvr_poly_cxt_txr_fast(
-                &hdr,
-                list,
-
-                go->materials[submesh_num]->texture->flags,
-                go->materials[submesh_num]->texture->lw,
-                go->materials[submesh_num]->texture->lh,
-                (uint8_t*)go->materials[submesh_num]->texture->data - go->materials[submesh_num]->texture->offs,
-
-                PVR_FILTER_BILINEAR,
-
-                // flip_u, clamp_u, flip_v, clamp_v,
-                PVR_UVFLIP_NONE,
-                PVR_UVCLAMP_NONE,
-                PVR_UVFLIP_NONE,
-                PVR_UVCLAMP_NONE,
-                PVR_UVFMT_16BIT,
-
-                PVR_CLRFMT_4FLOATS,
-                list != PVR_LIST_OP_POLY ? PVR_BLEND_SRCALPHA : PVR_BLEND_ONE,
-                list != PVR_LIST_OP_POLY ? PVR_BLEND_INVSRCALPHA : PVR_BLEND_ZERO,
-                PVR_DEPTHCMP_GEQUAL,
-                PVR_DEPTHWRITE_ENABLE,
-                culling,
-                PVR_FOG_DISABLE
-            );
+        // the queues are sorted by texture, so this often matches the previous submesh, even across objects
+        if (memcmp(&hdr, &lastPolyHeader, 4 * sizeof(uint32_t)) != 0) {
+            pvr_prim(&hdr, sizeof(hdr));
+            lastPolyHeader = hdr;
+			#if defined(DC_SIM)
+			simStats.polyHeaders++;
+			#endif
         } else {
-            pvr_poly_cxt_col_fast(
-                &hdr,
-                list,
-
-                PVR_CLRFMT_4FLOATS,
-                list != PVR_LIST_OP_POLY ? PVR_BLEND_SRCALPHA : PVR_BLEND_ONE,
-                list != PVR_LIST_OP_POLY ? PVR_BLEND_INVSRCALPHA : PVR_BLEND_ZERO,
-                PVR_DEPTHCMP_GEQUAL,
-                PVR_DEPTHWRITE_ENABLE,
-                culling,
-                PVR_FOG_DISABLE
-            );
+			#if defined(DC_SIM)
+			simStats.polyHeadersSaved++;
+			#endif
         }
 
-        pvr_prim(&hdr, sizeof(hdr));
-
         RGBAf residual, material;
         // Ambient Alpha ALWAYS = 1.0
         residual.alpha = go->materials[submesh_num]->color.alpha;
@@ -2668,19 +3144,29 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 			effectiveSubmeshNum = go->submesh_count + go->logical_submesh;
 		}
 
-        auto meshletInfoBytes = &go->mesh->data[meshInfo[effectiveSubmeshNum].meshletOffset];
+		auto lodInfo = &meshInfo[effectiveSubmeshNum * meshLodLevels + entry->lod];
+		auto bakeNum = submesh_num * meshLodLevels + entry->lod;
+        auto meshletInfoBytes = &go->mesh->data[lodInfo->meshletOffset];
         
 		size_t colorsSize = 0;
-        for (int16_t meshletNum = 0; meshletNum < meshInfo[effectiveSubmeshNum].meshletCount; meshletNum++) {
+        for (int16_t meshletNum = 0; meshletNum < lodInfo->meshletCount; meshletNum++) {
             auto meshlet = (const MeshletInfo*)meshletInfoBytes;
             meshletInfoBytes += sizeof(MeshletInfo) - 8 ; // (skin ? 0 : 8);
 
 			auto colorsBase = colorsSize;
-			colorsSize += meshlet->vertexCount * 3;
+			colorsSize += meshlet->vertexCount;
 
-			#if defined(DC_SIM)
-			total_idx += meshlet->indexCount;
-			#endif
+			// every triangle faces away from the camera, see MeshletInfo::coneCutoff
+			if (meshlet->coneCutoff != 127) {
+				V3d toMeshlet = sub(meshlet->boundingSphere.center, camLocal);
+				float axisDot = (toMeshlet.x * meshlet->coneAxis[0] + toMeshlet.y * meshlet->coneAxis[1] + toMeshlet.z * meshlet->coneAxis[2]) * (1.0f / 127.0f);
+				if (axisDot >= meshlet->coneCutoff * (1.0f / 127.0f) * length(toMeshlet) + meshlet->boundingSphere.radius) {
+					#if defined(DC_SIM)
+					simStats.meshletsBackfaced++;
+					#endif
+					continue;
+				}
+			}
 
             unsigned clippingRequired = 0;
 			Sphere sphere = meshlet->boundingSphere;
@@ -2694,6 +3180,9 @@ void renderMesh(camera_t* cam, game_object_t* go) {
                 auto local_frustumTestResult = cam->frustumTestSphereNear(&sphere);
                 if ( local_frustumTestResult == camera_t::SPHEREOUTSIDE) {
                     // printf("Outside local frustum cull\n");
+					#if defined(DC_SIM)
+					simStats.meshletsCulled++;
+					#endif
                     continue;
                 }
 
@@ -2702,8 +3191,13 @@ void renderMesh(camera_t* cam, game_object_t* go) {
                 }
             }
 
-            //isTextured, isNormaled, isColored, small_xyz, pad_xyz, small_uv
-            unsigned selector = meshlet->flags;
+			#if defined(DC_SIM)
+			simStats.meshletsDrawn++;
+			simStats.indices += meshlet->indexCount;
+			#endif
+
+            //isTextured, isNormaled, isColored, small_xyz, pad_xyz, small_uv
+            unsigned selector = meshlet->flags;
 
             // template<bool hasTexture, bool small_xyz, bool forClip>
             unsigned smallSelector = ((selector & 8) ? 1 : 0) | clippingRequired * 2;
@@ -2717,8 +3211,7 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 
             {
 
-                mat_load(&cam->devViewProjScreen);
-                mat_apply((matrix_t*)&go->ltw);
+                mat_load(&entry->mvp);
 
                 if (selector & 8) {
                     // mat_load(&mtx);
@@ -2756,9 +3249,9 @@ void renderMesh(camera_t* cam, game_object_t* go) {
             } else if (go->bakedColors && !forceDynamicLights) {
 				// colorsBase
 				unsigned dstColOffset = textured ? offsetof(pvr_vertex64_t, a) : offsetof(pvr_vertex32_ut, a);
-                dce_set_mat_vertex_color(&residual, &material);
+                dce_set_mat_vertex_color_baked(&residual, &material);
                 mat_load(&DCE_MESHLET_MAT_VERTEX_COLOR);
-                tnlMeshletVertexColorBakedSelector[0](OCR_SPACE + dstColOffset, &go->bakedColors[submesh_num][colorsBase], meshlet->vertexCount);
+                tnlMeshletVertexColorBakedSelector[0](OCR_SPACE + dstColOffset, &go->bakedColors[bakeNum][colorsBase], meshlet->vertexCount);
 			} else {
                 unsigned dstColOffset = textured ? offsetof(pvr_vertex64_t, a) : offsetof(pvr_vertex32_ut, a);
                 tnlMeshletFillResidualSelector[0](OCR_SPACE + dstColOffset, meshlet->vertexCount, &residual);
@@ -2792,8 +3285,8 @@ void renderMesh(camera_t* cam, game_object_t* go) {
             }
 
 			
-			if (go->partiallyBakedColors && go->partiallyBakedColors[submesh_num][meshletNum] && !forceDynamicLights) {
-				auto animatedLights = go->partiallyBakedColors[submesh_num][meshletNum];
+			if (go->partiallyBakedColors && go->partiallyBakedColors[bakeNum][meshletNum] && !forceDynamicLights) {
+				auto animatedLights = go->partiallyBakedColors[bakeNum][meshletNum];
 
 				while(animatedLights->light) {
 					if (animatedLights->light->gameObject->isActive()) {
@@ -2806,7 +3299,7 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 				}
 			}
 
-			{
+			if (entry->lightsCount) {
 				unsigned normalOffset = (selector & 8) ? (3 * 2) : (3 * 4);
                 if (selector & 16) {
                     normalOffset += 1 * 2;
@@ -2833,19 +3326,11 @@ void renderMesh(camera_t* cam, game_object_t* go) {
 
 				r_matrix_t mtxNormal = localToWorldNormal(go->ltw);
 
-				auto point_light_list = dynamic_point_lights;
-
-				if (forceDynamicLights || (go->flags & go_movable)) {
-					point_light_list = point_lights;
-				}
-
-				for (auto point = point_light_list; *point; point++) {
-					if ((*point)->gameObject->isActive()) {
-						float dist = length(sub((*point)->gameObject->ltw.pos, sphere.center));
-						float maxDist = sphere.radius + (*point)->Range;
-						if (dist < maxDist) {
-							tnlMeshletPointColorSelector[smallSelector](&go->mesh->data[meshlet->vertexOffset], OCR_SPACE + dstColOffset, normalPointer, meshlet->vertexCount, vtxSize, *point, det, &mtx, (matrix_t*)&mtxNormal, go->materials[submesh_num]);
-						}
+				for (auto point = objectLights; point != objectLights + entry->lightsCount; point++) {
+					float dist = length(sub((*point)->gameObject->ltw.pos, sphere.center));
+					float maxDist = sphere.radius + (*point)->Range;
+					if (dist < maxDist) {
+						tnlMeshletPointColorSelector[smallSelector](&go->mesh->data[meshlet->vertexOffset], OCR_SPACE + dstColOffset, normalPointer, meshlet->vertexCount, vtxSize, *point, det, &mtx, (matrix_t*)&mtxNormal, go->materials[submesh_num]);
 					}
 				}
 			}
@@ -2945,10 +3430,10 @@ bool IsQuadConvex(const V3d* v0, const V3d* v1, const V3d* v2, const V3d* v3)
     return (allNonNegative || allNonPositive);
 }
 
-void renderQuads(camera_t* cam, game_object_t* go) {
+void renderQuads(camera_t* cam, render_queue_entry_t* entry) {
+	auto go = entry->go;
 	{
-		mat_load(&cam->devViewProjScreen);
-		mat_apply((matrix_t*)&go->ltw);
+		mat_load(&entry->mvp);
 
 		// std::cout << "mesh: " << go->mesh << std::endl;
 		
@@ -3416,168 +3901,330 @@ void setGameObject(component_type_t type, component_base_t* component, native::g
     }
 }
 
-void animator_t::update(float deltaTime) {
-    
-    for (size_t i = 0; i < num_bound_animations; ++i) {
-        auto& boundAnim = bound_animations[i];
-		auto& currentTime = boundAnim.currentTime;
-		currentTime += deltaTime;
-        for (size_t j = 0; j < boundAnim.animation->num_tracks; ++j) {
-            auto& track = boundAnim.animation->tracks[j];
-            auto& currentFrame = boundAnim.currentFrames[j];
-            while (currentFrame < track.num_keys - 1 && currentTime >= track.times[currentFrame + 1]) {
-                ++currentFrame;
-            }
-			bool fakeInterpolation = false;
-			float effectiveTime = currentTime;
-            if (currentFrame >= track.num_keys - 1) {
-				currentFrame = track.num_keys - 2;
-				effectiveTime = track.times[currentFrame + 1];
-				fakeInterpolation = true;
-            }
-            float t = (effectiveTime - track.times[currentFrame]) / (track.times[currentFrame + 1] - track.times[currentFrame]);
-            auto value = track.values[currentFrame];
-            auto nextValue = track.values[currentFrame + 1];
+void native::game_object_t::setComponents(component_t* componentList) {
+	components = componentList;
+	componentMask = 0;
 
-			if (fakeInterpolation) {
-				value = nextValue;
+	size_t count = 0;
+	while (componentList[count * 2].componentType != ct_eol) {
+		count++;
+	}
+
+	// insertion sort of [type, data] pairs, lists are a handful of entries
+	for (size_t i = 1; i < count; i++) {
+		component_t type = componentList[i * 2];
+		component_t data = componentList[i * 2 + 1];
+		size_t j = i;
+		while (j > 0 && componentSlot(componentList[(j - 1) * 2].componentType) > componentSlot(type.componentType)) {
+			componentList[j * 2] = componentList[(j - 1) * 2];
+			componentList[j * 2 + 1] = componentList[(j - 1) * 2 + 1];
+			j--;
+		}
+		componentList[j * 2] = type;
+		componentList[j * 2 + 1] = data;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		auto bit = 1u << componentSlot(componentList[i * 2].componentType);
+		assert(!(componentMask & bit) && "duplicate component type in list");
+		componentMask |= bit;
+	}
+}
+
+static void setAnimatedNothing(const animation_binding_t& binding, float key, float sample) { }
+
+static void setAnimatedFloat(const animation_binding_t& binding, float key, float sample) {
+	*(float*)binding.target = sample;
+}
+
+static void setAnimatedTransform(const animation_binding_t& binding, float key, float sample) {
+	*(float*)binding.target = sample;
+	binding.gameObject->markTransformDirty();
+}
+
+static void setAnimatedActive(const animation_binding_t& binding, float key, float sample) {
+	binding.gameObject->setActive(key == 1);
+}
+
+static void setAnimatedAudioEnabled(const animation_binding_t& binding, float key, float sample) {
+	((audio_source_t*)binding.target)->setEnabled(key == 1);
+}
+
+static void setAnimatedMeshEnabled(const animation_binding_t& binding, float key, float sample) {
+	binding.gameObject->mesh_enabled = key == 1;
+	binding.gameObject->markMeshDirty();
+}
+
+// materials[0] can itself be animated, so it is looked up on every write
+template<float RGBAf::*channel>
+static void setAnimatedMaterialColor(const animation_binding_t& binding, float key, float sample) {
+	binding.gameObject->materials[0]->color.*channel = sample;
+}
+
+static void setAnimatedMaterial(const animation_binding_t& binding, float key, float sample) {
+	binding.gameObject->materials[0] = materials[key];
+}
+
+static animation_binding_t resolveAnimationBinding(animation_property_key property, native::game_object_t* target) {
+	animation_binding_t binding = { setAnimatedNothing, nullptr, target };
+
+	switch (property) {
+		case Transform_m_LocalPosition_x: binding = { setAnimatedTransform, &target->position.x, target }; break;
+		case Transform_m_LocalPosition_y: binding = { setAnimatedTransform, &target->position.y, target }; break;
+		case Transform_m_LocalPosition_z: binding = { setAnimatedTransform, &target->position.z, target }; break;
+		case Transform_localEulerAnglesRaw_x: binding = { setAnimatedTransform, &target->rotation.x, target }; break;
+		case Transform_localEulerAnglesRaw_y: binding = { setAnimatedTransform, &target->rotation.y, target }; break;
+		case Transform_localEulerAnglesRaw_z: binding = { setAnimatedTransform, &target->rotation.z, target }; break;
+		case Transform_m_LocalScale_x: binding = { setAnimatedTransform, &target->scale.x, target }; break;
+		case Transform_m_LocalScale_y: binding = { setAnimatedTransform, &target->scale.y, target }; break;
+		case Transform_m_LocalScale_z: binding = { setAnimatedTransform, &target->scale.z, target }; break;
+
+		case GameObject_IsActive: binding.set = setAnimatedActive; break;
+
+		case AudioSource_Volume:
+			if (auto audioSource = target->getComponent<audio_source_t>()) {
+				binding = { setAnimatedFloat, &audioSource->volume, target };
 			}
+			break;
+		case AudioSource_Enabled:
+			if (auto audioSource = target->getComponent<audio_source_t>()) {
+				binding = { setAnimatedAudioEnabled, audioSource, target };
+			}
+			break;
 
-            if (boundAnim.bindings[j] == SIZE_MAX) {
-                continue;
-            }
-            auto& target = gameObjects[boundAnim.bindings[j]];
-            switch (track.property_key) {
-                case Transform_m_LocalPosition_x:
-                    target->position.x = value + t * (nextValue - value);
-                    break;
-                case Transform_m_LocalPosition_y:
-                    target->position.y = value + t * (nextValue - value);
-                    break;
-                case Transform_m_LocalPosition_z:
-                    target->position.z = value + t * (nextValue - value);
-                    break;
-                case Transform_localEulerAnglesRaw_x:
-                    target->rotation.x = value + t * (nextValue - value);
-                    break;
-                case Transform_localEulerAnglesRaw_y:
-                    target->rotation.y = value + t * (nextValue - value);
-                    break;
-                case Transform_localEulerAnglesRaw_z:
-                    target->rotation.z = value + t * (nextValue - value);
-                    break;
-                case Transform_m_LocalScale_x:
-                    target->scale.x = value + t * (nextValue - value);
-                    break;
-                case Transform_m_LocalScale_y:
-                    target->scale.y = value + t * (nextValue - value);
-                    break;
-                case Transform_m_LocalScale_z:
-                    target->scale.z = value + t * (nextValue - value);
-                    break;
-				case GameObject_IsActive:
-					target->setActive(value == 1);
-					break;
-				case AudioSource_Volume:
-					{
-						auto audioSource = target->getComponent<audio_source_t>();
-						if (audioSource) {
-							audioSource->volume = value + t * (nextValue - value);
-						}
-					}
-					break;
-				case AudioSource_Enabled:
-					{
-						auto audioSource = target->getComponent<audio_source_t>();
-						if (audioSource) {
-							audioSource->setEnabled(value == 1);
-						}
-					}
-					break;
+		case Camera_FOV:
+			if (auto camera = target->getComponent<camera_t>()) {
+				binding = { setAnimatedFloat, &camera->fov, target };
+			}
+			break;
+
+		case MeshRenderer_Enabled: binding.set = setAnimatedMeshEnabled; break;
+
+		// meshes are only assigned at load, so a meshless target stays meshless
+		case MeshRenderer_material_Color_a:
+			if (target->mesh) binding.set = setAnimatedMaterialColor<&RGBAf::alpha>;
+			break;
+		case MeshRenderer_material_Color_r:
+			if (target->mesh) binding.set = setAnimatedMaterialColor<&RGBAf::red>;
+			break;
+		case MeshRenderer_material_Color_g:
+			if (target->mesh) binding.set = setAnimatedMaterialColor<&RGBAf::green>;
+			break;
+		case MeshRenderer_material_Color_b:
+			if (target->mesh) binding.set = setAnimatedMaterialColor<&RGBAf::blue>;
+			break;
+		case MeshRenderer_m_Materials_0:
+			if (target->mesh) binding.set = setAnimatedMaterial;
+			break;
+
+		case Light_Color_r:
+			if (auto light = target->getComponent<point_light_t>()) {
+				binding = { setAnimatedFloat, &light->color.red, target };
+			}
+			break;
+		case Light_Color_g:
+			if (auto light = target->getComponent<point_light_t>()) {
+				binding = { setAnimatedFloat, &light->color.green, target };
+			}
+			break;
+		case Light_Color_b:
+			if (auto light = target->getComponent<point_light_t>()) {
+				binding = { setAnimatedFloat, &light->color.blue, target };
+			}
+			break;
+		case Light_Intensity:
+			if (auto light = target->getComponent<point_light_t>()) {
+				binding = { setAnimatedFloat, &light->intensity, target };
+			}
+			break;
 
-				case Camera_FOV:
-					{
-						auto camera = target->getComponent<camera_t>();
-						if (camera) {
-							camera->fov = value + t * (nextValue - value);
-						}
-					}
-					break;
+		default:
+			break;
+	}
 
-				case MeshRenderer_Enabled:
-				{
-					target->mesh_enabled = value == 1;
-				}
-				break;
-				case MeshRenderer_material_Color_a:
-				{
-					if (target->mesh) {
-						target->materials[0]->color.alpha =  value + t * (nextValue - value);
-					}
-				}
-				break;
-				case MeshRenderer_material_Color_b:
-				{
-					if (target->mesh) {
-						target->materials[0]->color.blue =  value + t * (nextValue - value);
-					}
-				}
-				break;
-				case MeshRenderer_material_Color_g:
-				{
-					if (target->mesh) {
-						target->materials[0]->color.green =  value + t * (nextValue - value);
-					}
-				}
-				break;
-				case MeshRenderer_material_Color_r:
-				{
-					if (target->mesh) {
-						target->materials[0]->color.red =  value + t * (nextValue - value);
-					}
-				}
-				break;
+	return binding;
+}
 
-				case MeshRenderer_m_Materials_0:
-				{
-					if (target->mesh) {
-						target->materials[0] = materials[value];
-					}
-				}
-				break;
+void animator_t::bind() {
+	for (size_t i = 0; i < num_bound_animations; ++i) {
+		auto& boundAnim = bound_animations[i];
+		auto animation = boundAnim.animation;
+		boundAnim.targets = new animation_binding_t[animation->num_tracks];
+		for (size_t j = 0; j < animation->num_tracks; ++j) {
+			if (boundAnim.bindings[j] == SIZE_MAX) {
+				boundAnim.targets[j] = { setAnimatedNothing, nullptr, nullptr };
+			} else {
+				boundAnim.targets[j] = resolveAnimationBinding(animation->tracks[j].property_key, gameObjects[boundAnim.bindings[j]]);
+			}
+		}
+	}
+}
 
-				case Light_Color_b: {
-					auto light = target->getComponent<point_light_t>();
-					if (light) {
-						light->color.blue = value + t * (nextValue - value);
-					}
-				}
-				break;
+// Returns the key whose segment contains time, or num_keys - 1 past the end.
+// Playback normally moves at most a key or two per frame, so walk forward from
+// the cached cursor and only binary search on seeks, rewinds or long hitches.
+static unsigned seekKeyFrame(const animation_track_t& track, unsigned cursor, float time) {
+	constexpr unsigned maxLinearSteps = 4;
+	unsigned lastKey = track.num_keys - 1;
+
+	if (cursor <= lastKey && (cursor == 0 || time >= track.keyTime(cursor))) {
+		for (unsigned step = 0; step < maxLinearSteps; step++) {
+			if (cursor >= lastKey || time < track.keyTime(cursor + 1)) {
+				return cursor;
+			}
+			++cursor;
+		}
+	}
 
-				case Light_Color_g: {
-					auto light = target->getComponent<point_light_t>();
-					if (light) {
-						light->color.green = value + t * (nextValue - value);
-					}
-				}
-				break;
+	auto it = std::upper_bound(track.times + 1, track.times + track.num_keys, time, [&track](float t, uint16_t key) {
+		return t < key * track.timeScale;
+	});
+	return it - track.times - 1;
+}
 
-				case Light_Color_r: {
-					auto light = target->getComponent<point_light_t>();
-					if (light) {
-						light->color.red = value + t * (nextValue - value);
-					}
-				}
-				break;
+// Moves cursor to time and samples a track with at least two keys there. key is the value
+// of the current keyframe. Past the last key the cursor stays on the last segment and both
+// values are the last key's.
+static void sampleTrack(const animation_track_t& track, unsigned& cursor, float time, float* key, float* sample) {
+	cursor = seekKeyFrame(track, cursor, time);
+	bool fakeInterpolation = false;
+	float effectiveTime = time;
+	if (cursor >= track.num_keys - 1) {
+		cursor = track.num_keys - 2;
+		effectiveTime = track.keyTime(cursor + 1);
+		fakeInterpolation = true;
+	}
+	float keyTime = track.keyTime(cursor);
+	float t = (effectiveTime - keyTime) / (track.keyTime(cursor + 1) - keyTime);
+	auto value = track.keyValue(cursor);
+	auto nextValue = track.keyValue(cursor + 1);
 
-				case Light_Intensity: {
-					auto light = target->getComponent<point_light_t>();
-					if (light) {
-						light->intensity = value + t * (nextValue - value);
-					}
+	if (fakeInterpolation) {
+		value = nextValue;
+	}
+
+	*key = value;
+	*sample = value + t * (nextValue - value);
+}
+
+#if defined(DC_SIM)
+// tlj-sim.elf --check-animations: plays random quantised tracks through sampleTrack and compares
+// every sample with the forward walk animator_t::update used before seekKeyFrame. That walk
+// never moved backwards, so after a rewind the reference walks again from key 0
+static bool checkAnimationSeek() {
+	uint32_t seed = 1;
+	auto random = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return seed >> 8;
+	};
+
+	auto referenceSample = [](const animation_track_t& track, unsigned& frame, float time, float* key, float* sample) {
+		while (frame < track.num_keys - 1 && time >= track.keyTime(frame + 1)) {
+			++frame;
+		}
+		bool fakeInterpolation = false;
+		float effectiveTime = time;
+		if (frame >= track.num_keys - 1) {
+			frame = track.num_keys - 2;
+			effectiveTime = track.keyTime(frame + 1);
+			fakeInterpolation = true;
+		}
+		float keyTime = track.keyTime(frame);
+		float t = (effectiveTime - keyTime) / (track.keyTime(frame + 1) - keyTime);
+		auto value = track.keyValue(frame);
+		auto nextValue = track.keyValue(frame + 1);
+		if (fakeInterpolation) {
+			value = nextValue;
+		}
+		*key = value;
+		*sample = value + t * (nextValue - value);
+	};
+
+	size_t samples = 0, mismatches = 0, hitches = 0, rewinds = 0, loops = 0;
+	for (unsigned trackNum = 0; trackNum < 500; trackNum++) {
+		// like the exporter writes them, keys may share a time and the first needn't be at 0
+		size_t numKeys = 2 + random() % 96;
+		std::vector<uint16_t> times(numKeys), values(numKeys);
+		unsigned keyTime = random() % 3 ? 0 : random() % 200;
+		for (size_t k = 0; k < numKeys; k++) {
+			times[k] = keyTime;
+			values[k] = random() & 0xffff;
+			keyTime = std::min(65535u, keyTime + (random() % 8 ? random() % 300 : 0));
+		}
+
+		animation_track_t track = { };
+		track.times = times.data();
+		track.values = values.data();
+		track.num_keys = numKeys;
+		track.timeScale = 1.0f / 1000.0f;
+		track.valueOffset = -1;
+		track.valueScale = 2.0f / 65535.0f;
+		float maxTime = track.keyTime(numKeys - 1) + (random() % 500) / 1000.0f;
+
+		unsigned cursor = 0, reference = 0;
+		float currentTime = 0;
+		for (unsigned frame = 0; frame < 3000; frame++) {
+			float previousTime = currentTime;
+			unsigned kind = random() % 100;
+			if (kind < 75) {
+				currentTime += (1 + random() % 3) / 60.0f;
+			} else if (kind < 88) {
+				currentTime += (random() % 2000) / 1000.0f;
+				hitches++;
+			} else if (kind < 96) {
+				currentTime = std::max(0.0f, currentTime - (random() % 1500) / 1000.0f);
+			} else {
+				currentTime = (random() % 1000) * maxTime / 1000.0f;
+			}
+			if (currentTime < previousTime) {
+				reference = 0;
+				rewinds++;
+			}
+
+			float key, sample, referenceKey, referenceValue;
+			sampleTrack(track, cursor, currentTime, &key, &sample);
+			referenceSample(track, reference, currentTime, &referenceKey, &referenceValue);
+			samples++;
+			// bitwise, so keys sharing a time compare their nans too
+			if (cursor != reference || memcmp(&key, &referenceKey, sizeof(key)) || memcmp(&sample, &referenceValue, sizeof(sample))) {
+				if (mismatches++ < 10) {
+					std::cout << "check-animations: track " << trackNum << " frame " << frame << " time " << currentTime
+						<< " key " << cursor << " sample " << sample << ", walk has key " << reference << " sample " << referenceValue << std::endl;
 				}
-				break;
+			}
+
+			// same as animator_t::update
+			if (currentTime >= maxTime) {
+				currentTime = 0;
+				cursor = reference = 0;
+				loops++;
+			}
+		}
+	}
+
+	std::cout << "check-animations: " << samples << " samples, " << hitches << " hitches, " << rewinds << " rewinds, "
+		<< loops << " loops, " << mismatches << " mismatches" << std::endl;
+	return mismatches == 0 && hitches && rewinds && loops;
+}
+#endif
+
+void animator_t::update(float deltaTime) {
+    
+    for (size_t i = 0; i < num_bound_animations; ++i) {
+        auto& boundAnim = bound_animations[i];
+		auto& currentTime = boundAnim.currentTime;
+		currentTime += deltaTime;
+        for (size_t j = 0; j < boundAnim.animation->num_tracks; ++j) {
+            auto& track = boundAnim.animation->tracks[j];
+            auto& binding = boundAnim.targets[j];
+            if (track.num_keys == 1) {
+                auto value = track.keyValue(0);
+                binding.set(binding, value, value);
+                continue;
             }
+            float key, sample;
+            sampleTrack(track, boundAnim.currentFrames[j], currentTime, &key, &sample);
+            binding.set(binding, key, sample);
         }
     }
 
@@ -3593,19 +4240,24 @@ void animator_t::update(float deltaTime) {
 	}
 }
 
-bool native::game_object_t::isActive() const {
-	if (flags & goi_inactive) {
-		return false;
-	} else if (parent) {
-		return parent->isActive();
+void native::game_object_t::computeActiveState() {
+	if (parent && !parent->isActive()) {
+		flags |= goi_inactive_parent;
+	} else {
+		flags &= ~goi_inactive_parent;
 	}
-	return true;
 }
 
-void native::game_object_t::computeActiveState() {
-	// if (inactiveFlags & goi_inactive) {
-
-	// }
+void recursive_compute_active_state(game_object_t* go) {
+	auto childNum = go->children;
+	while(*childNum != SIZE_MAX) {
+		auto child = gameObjects[*childNum++];
+		bool wasActive = child->isActive();
+		child->computeActiveState();
+		if (wasActive != child->isActive()) {
+			recursive_compute_active_state(child);
+		}
+	}
 }
 
 void recusrive_awake(game_object_t* go) {
@@ -3646,12 +4298,16 @@ void recusrive_disable(game_object_t* go) {
 
 void native::game_object_t::setActive(bool active) {
 	bool wasActive = isActive();
-	bool newFlags = !active ? goi_inactive : 0;
+	unsigned newFlags = !active ? goi_inactive : 0;
 
-	flags = (flags & ~goi_mask) | newFlags;
+	flags = (flags & ~goi_inactive) | newFlags;
 
 	bool nowActive = isActive();
 
+	if (wasActive != nowActive) {
+		recursive_compute_active_state(this);
+	}
+
 	if (!wasActive && nowActive) {
 		recusrive_awake(this);
 	}
@@ -3956,6 +4612,7 @@ void recusrive_game_object_activeinactive_t::interact() {
 	if (this->gameObjectToToggle != SIZE_MAX) {
 		auto gameObjectTT = gameObjects[this->gameObjectToToggle];
 		gameObjectTT->mesh_enabled = false;
+		gameObjectTT->markMeshDirty();
 		// TODO: do this correctly
 		gameObjectTT->setActive(false);
 		std::cout << "recusrive_game_object_activeinactive_t is partially implemented" << std::endl;
@@ -4039,6 +4696,7 @@ void player_movement_t::update(float deltaTime) {
 			float movementZ = cos(gameObject->rotation.y * deg2rad) * movement;
 			gameObject->position.x += movementX;
 			gameObject->position.z += movementZ;
+			gameObject->markTransformDirty();
 		}
 
 		static V3d lastPos = {-1000, -1000,-1000};
@@ -4061,6 +4719,7 @@ void player_movement_t::update(float deltaTime) {
 			float minGroundDistance = std::min(groundCheck1.distance, groundCheck2.distance);
 		
 			playa->position.y -= minGroundDistance - 0.5f - 3.8f/2; // TODO: the 3.8f should come from the character controller
+			playa->markTransformDirty();
 		}
 	}
 }
@@ -4114,8 +4773,10 @@ void mouse_look_t::update(float deltaTime) {
 	if (lookEnabled && pavo_state_t::getEnv()->canLook) {
 		if (rotateEnabled && pavo_state_t::getEnv()->canRotate) {
 			gameObjects[playerBodyIndex]->rotation.y += (float)state->joyx * rotateSpeed * deltaTime;
+			gameObjects[playerBodyIndex]->markTransformDirty();
 			gameObject->rotation.x += (float)state->joyy * rotateSpeed * deltaTime;
 			gameObject->rotation.x = std::clamp(gameObject->rotation.x, -89.0f, 89.0f);
+			gameObject->markTransformDirty();
 		}
 
 		if (pavo_state_t::getEnv()->onInteraction) {
@@ -4409,6 +5070,7 @@ void teleporter_t::teleport() {
 		// TODO this is wrong
 		playa->rotation = gameObjects[destinationIndex]->rotation;
 	}
+	playa->markTransformDirty();
 }
 
 void tv_programming_t::update(float deltaTime) {
@@ -4738,13 +5400,39 @@ void queueCoroutine(Task&& coroutine) {
 void InitializeFlowMachines();
 void InitializeAudioClips();
 void InitializeAudioSources();
+#if defined(DC_SIM)
+bool check_stream_refills();
+#endif
+
+// bumped every positionUpdate, objects recomputed this frame get it in ltw_stamp
+static unsigned ltwStamp;
 
 void positionUpdate() {
+	ltwStamp++;
+	// parents come before children in gameObjects, so a recomputed parent is seen through its ltw_stamp
 	for (auto go: gameObjects) {
 		if (!go->isActive()) {
 			go->meshSphere.radius = 0;
+			// ltw is stale by the time it gets activated again
+			go->flags |= go_transform_dirty;
+			continue;
+		}
+
+		if (!(go->flags & go_transform_dirty) && !(go->parent && go->parent->ltw_stamp == ltwStamp)) {
 			continue;
 		}
+		go->flags &= ~go_transform_dirty;
+		go->ltw_stamp = ltwStamp;
+
+		if (go->parent && !(go->parent->flags & go_static)) {
+			go->flags &= ~go_static;
+		}
+		if ((go->flags & (go_static | go_static_bvh)) == go_static_bvh) {
+			// moved out of its bvh node, cull it through the hierarchy from now on
+			for (auto p = go; p && !(p->flags & go_dynamic_subtree); p = p->parent) {
+				p->flags |= go_dynamic_subtree;
+			}
+		}
 
 		r_matrix_t pos_mtx = {
 			1, 0, 0, 0,
@@ -4844,77 +5532,205 @@ bool drawphys;
 constexpr bool drawphys = false;
 #endif
 
-inline Sphere mergeSpheres(const Sphere* A, const Sphere* B) {
-    // --- 1) ignore any degenerate (zero‑radius) sphere ---
-    if (A->radius == 0.0f) return *B;
-    if (B->radius == 0.0f) return *A;
+// projected meshSphere radius in pixels below which each coarser lod level is used
+constexpr float meshLodPixelRadius[meshLodLevels - 1] = { 48.0f, 16.0f };
+
+// FLT_MAX when the sphere reaches the near plane
+float projectedPixelRadius(camera_t* cam, game_object_t* go) {
+	float depth = dot(sub(go->meshSphere.center, cam->gameObject->ltw.pos), normalize(cam->gameObject->ltw.at));
+	if (depth <= cam->nearPlane) {
+		return FLT_MAX;
+	}
+
+	return go->meshSphere.radius * 240.0f / (cam->viewWindow.y * depth);
+}
 
-    // --- 2) now both A and B have radius > 0, do the normal merge ---
-    V3d d    = sub(B->center,   A->center);
-    float dist = length(d);
+unsigned selectMeshLod(float pixelRadius) {
+	unsigned lod = 0;
+	while (lod < meshLodLevels - 1 && pixelRadius < meshLodPixelRadius[lod]) {
+		lod++;
+	}
+	return lod;
+}
 
-    // one already contains the other?
-    if (A->radius >= dist + B->radius) return *A;
-    if (B->radius >= dist + A->radius) return *B;
+void queueObject(camera_t* cam, game_object_t* go, bool knownInside) {
+	if (!go->mesh_enabled || !go->mesh || !go->materials) {
+		return;
+	}
 
-    // otherwise build the minimal enclosing sphere
-    float Rm = (dist + A->radius + B->radius) * 0.5f;
-    float K  = (Rm - A->radius) / dist;
-    // new center = A->center + K * (B->center - A->center)
-    V3d  Cm = add(A->center, scale(d, K));
+	auto frustum = knownInside ? (int)camera_t::SPHEREINSIDE : cam->frustumTestSphereNear(&go->meshSphere);
+	if (frustum == camera_t::SPHEREOUTSIDE) {
+		return;
+	}
+
+	bool hasAnyOpaque = false;
+	bool hasAnyPT = false;
+	bool hasAnyTransp = false;
+	for (int subM = 0; subM < go->submesh_count; subM++) {
+		auto matMode = go->materials[subM]->mode;
+		hasAnyOpaque |= matMode == 0;
+		hasAnyPT |= matMode == 1;
+		hasAnyTransp |= matMode == 2;
+	}
 
-    return Sphere{ Cm, Rm };
+	assert(renderQueueEntries.size() < renderQueueEntries.capacity());
+	auto entry = &renderQueueEntries.emplace_back();
+	entry->go = go;
+	entry->frustum = frustum;
+	entry->occluded = -1;
+	entry->lightsBegin = UINT32_MAX;
+	entry->pixelRadius = projectedPixelRadius(cam, go);
+	entry->lod = selectMeshLod(entry->pixelRadius);
+	mat_load(&cam->devViewProjScreen);
+	mat_apply((matrix_t*)&go->ltw);
+	mat_store(&entry->mvp);
+
+	if (go->materials[0]->mode == 0) {
+		renderQueues[0].push_back(entry);
+	}
+	if (hasAnyOpaque) {
+		renderQueues[1].push_back(entry);
+	}
+	if (hasAnyPT) {
+		renderQueues[2].push_back(entry);
+	}
+	if (hasAnyTransp) {
+		renderQueues[3].push_back(entry);
+	}
 }
 
-void mergeChildSpheresAndFrustum(camera_t* cam, game_object_t* go) {
-	if (!go->isActive()) {
-		go->compoundSphere.radius = 0;
-		go->compoundVisible = false;
+// objects outside of the static bvh, subtrees with none of them are skipped
+void queueSelfAndChildren(camera_t* cam, game_object_t* go) {
+	if (!go->isActive() || !(go->flags & go_dynamic_subtree)) {
 		return;
 	}
 
-	go->compoundSphere = go->meshSphere;
+	if (!go->inStaticBvh()) {
+		queueObject(cam, go, false);
+	}
 	auto childNum = go->children;
 	while(*childNum != SIZE_MAX) {
 		auto child = gameObjects[*childNum++];
-		mergeChildSpheresAndFrustum(cam, child);
-		go->compoundSphere = mergeSpheres(&go->compoundSphere, &child->compoundSphere);
+		queueSelfAndChildren(cam, child);
 	}
-
-	go->compoundVisible = cam->frustumTestSphere(&go->compoundSphere) != camera_t::SPHEREOUTSIDE;
 }
 
-template<int mode>
-void renderSelfAndChildren(camera_t* cam, game_object_t* go) {
-	if (!go->compoundVisible) return;
-
-	if (go->mesh_enabled && go->mesh && go->materials) {
-		if (mode == 0 && go->materials[0]->mode == 0) {
-			renderQuads(cam, go);
+// after InitializeHierarchy, flags the parents of everything that is not culled through the static bvh
+void initializeStaticBvh() {
+	// children come after their parents in gameObjects
+	for (auto it = gameObjects.rbegin(); it != gameObjects.rend(); it++) {
+		auto go = *it;
+		if (go->mesh && !go->inStaticBvh()) {
+			go->flags |= go_dynamic_subtree;
 		}
-		bool hasAnyOpaque = false;
-		bool hasAnyPT = false;
-		bool hasAnyTransp = false;
-		for (int subM = 0; subM < go->submesh_count; subM++) {
-			auto matMode = go->materials[subM]->mode;
-			hasAnyOpaque |= matMode == 0;
-			hasAnyPT |= matMode == 1;
-			hasAnyTransp |= matMode == 2;
+		if ((go->flags & go_dynamic_subtree) && go->parent) {
+			go->parent->flags |= go_dynamic_subtree;
 		}
-		if (mode == 1 && hasAnyOpaque) {
-			renderMesh<PVR_LIST_OP_POLY, 0>(cam, go);
+	}
+
+	// at most one entry per game object, so entry pointers stay valid
+	renderQueueEntries.reserve(gameObjects.size());
+	for (auto& queue: renderQueues) {
+		queue.reserve(gameObjects.size());
+	}
+}
+
+void queueStaticBvh(camera_t* cam) {
+	// nodes before insideEnd are inside a node that is fully in the frustum
+	size_t insideEnd = 0;
+	for (size_t nodeNum = 0; nodeNum < staticBvhNodes.size(); ) {
+		auto& node = staticBvhNodes[nodeNum];
+		if (nodeNum >= insideEnd) {
+			auto visible = cam->frustumTestSphere(&node.bounds);
+			if (visible == camera_t::SPHEREOUTSIDE) {
+				nodeNum = node.skip;
+				continue;
+			}
+			if (visible == camera_t::SPHEREINSIDE) {
+				insideEnd = node.skip;
+			}
 		}
-		if (mode == 2 && hasAnyPT) {
-			renderMesh<PVR_LIST_PT_POLY, 1>(cam, go);
+
+		for (unsigned objectNum = 0; objectNum < node.objectCount; objectNum++) {
+			auto go = gameObjects[staticBvhObjects[node.firstObject + objectNum]];
+			if (!go->inStaticBvh() || !go->isActive()) {
+				continue;
+			}
+			queueObject(cam, go, nodeNum < insideEnd);
 		}
-		if (mode == 3 && hasAnyTransp) {
-			renderMesh<PVR_LIST_TR_POLY, 2>(cam, go);
+		nodeNum++;
+	}
+}
+
+// texture of the first submesh drawn in mode, what the queues are sorted by
+static texture_t* firstTexture(game_object_t* go, int mode) {
+	for (size_t submesh_num = 0; submesh_num < go->submesh_count; submesh_num++) {
+		if (go->materials[submesh_num]->mode == mode) {
+			return go->materials[submesh_num]->texture;
 		}
 	}
-	auto childNum = go->children;
-	while(*childNum != SIZE_MAX) {
-		auto child = gameObjects[*childNum++];
-		renderSelfAndChildren<mode>(cam, child);
+	return nullptr;
+}
+
+// objects using the same texture end up next to each other and renderMesh can skip their headers
+static void sortQueueByTexture(std::vector<render_queue_entry_t*>& queue, int mode) {
+	std::stable_sort(queue.begin(), queue.end(), [mode](const render_queue_entry_t* a, const render_queue_entry_t* b) {
+		return std::less<texture_t*>()(firstTexture(a->go, mode), firstTexture(b->go, mode));
+	});
+}
+
+// the one culling pass per frame, the list passes below only walk the queues
+void buildRenderQueues(camera_t* cam) {
+	renderQueueEntries.clear();
+	frameLights.clear();
+	for (auto& queue: renderQueues) {
+		queue.clear();
+	}
+
+	queueStaticBvh(cam);
+
+	auto rootNum = roots;
+	do {
+		queueSelfAndChildren(cam, gameObjects[*rootNum++]);
+	} while(*rootNum != SIZE_MAX);
+
+	// biggest on screen first, so the occluder budget goes to the ones that hide the most
+	std::sort(renderQueues[0].begin(), renderQueues[0].end(), [](const render_queue_entry_t* a, const render_queue_entry_t* b) {
+		return a->pixelRadius > b->pixelRadius;
+	});
+
+	// TR keeps its order for blending
+	sortQueueByTexture(renderQueues[1], 0);
+	sortQueueByTexture(renderQueues[2], 1);
+}
+
+template<int mode>
+void renderQueue(camera_t* cam) {
+	unsigned occluderQuads = 0;
+	lastPolyHeader.cmd = 0;
+	for (auto entry: renderQueues[mode]) {
+		if (mode == 0) {
+			// smaller occluders further down may still fit
+			unsigned quadCount = entry->go->mesh->quadData[2];
+			if (occluderQuads + quadCount > occluderQuadBudget) {
+				#if defined(DC_SIM)
+				simStats.occludersSkipped++;
+				#endif
+				continue;
+			}
+			occluderQuads += quadCount;
+			#if defined(DC_SIM)
+			simStats.occludersDrawn++;
+			simStats.occluderQuads += quadCount;
+			#endif
+			renderQuads(cam, entry);
+		} else if (mode == 1) {
+			renderMesh<PVR_LIST_OP_POLY, 0>(cam, entry);
+		} else if (mode == 2) {
+			renderMesh<PVR_LIST_PT_POLY, 1>(cam, entry);
+		} else if (mode == 3) {
+			renderMesh<PVR_LIST_TR_POLY, 2>(cam, entry);
+		}
 	}
 }
 
@@ -5062,6 +5878,21 @@ static void render_skybox(camera_t* camera) {
     }
 }
 
+// lod levels that weren't worth simplifying share the meshlets, and the bakes, of the level before them
+static bool isLodAlias(const MeshInfo* meshInfo, size_t bakeNum) {
+	return (bakeNum % meshLodLevels) && meshInfo[bakeNum].meshletOffset == meshInfo[bakeNum - 1].meshletOffset;
+}
+
+// RGB565, what tnlMeshletVertexColorBaked reads
+static void packBakedColors(uint16_t* dst, const uint8_t* bgr, uint32_t vertexCount) {
+	for (uint32_t i = 0; i < vertexCount; i++, bgr += 3) {
+		unsigned b = (bgr[0] * 31 + 127) / 255;
+		unsigned g = (bgr[1] * 63 + 127) / 255;
+		unsigned r = (bgr[2] * 31 + 127) / 255;
+		dst[i] = (r << 11) | (g << 5) | b;
+	}
+}
+
 void bakeLights() {
 	for (auto gameObject: gameObjects) {
 		if (!gameObject->mesh || !gameObject->materials || (gameObject->flags & go_movable)) {
@@ -5070,7 +5901,9 @@ void bakeLights() {
 
 		// bakedColors
 		const MeshInfo* meshInfo = (const MeshInfo*)&gameObject->mesh->data[0];
-		uint8_t* colors = nullptr;
+		uint16_t* colors = nullptr;
+		// the bake kernel accumulates 8 bit BGR, packed once all lights are in
+		std::vector<uint8_t> meshletColors;
 		std::vector<size_t> submesh_colors;
 		size_t colorsSize = 0;
 
@@ -5081,102 +5914,113 @@ void bakeLights() {
 				// huh?
 				break;
 			}
-			auto meshletInfoBytes = &gameObject->mesh->data[meshInfo[submesh_num].meshletOffset];
-			bool textured = gameObject->materials[submesh_num]->texture != nullptr;
-			
-			submesh_colors.push_back(colorsSize);
+			// every lod level gets its own colors, levels that share meshlets share them too
+			for (unsigned lod = 0; lod < meshLodLevels; lod++) {
+				auto& lodInfo = meshInfo[submesh_num * meshLodLevels + lod];
+				if (isLodAlias(meshInfo, submesh_num * meshLodLevels + lod)) {
+					submesh_colors.push_back(submesh_colors.back());
+					mesh_partial_bake.push_back(mesh_partial_bake.back());
+					continue;
+				}
 
-			std::vector<std::vector<animated_light_t>> sumesh_partial_bake;
-			for (int16_t meshletNum = 0; meshletNum < meshInfo[submesh_num].meshletCount; meshletNum++) {
-				auto meshlet = (const MeshletInfo*)meshletInfoBytes;
-				meshletInfoBytes += sizeof(MeshletInfo) - 8 ; // (skin ? 0 : 8);
+				auto meshletInfoBytes = &gameObject->mesh->data[lodInfo.meshletOffset];
+
+				submesh_colors.push_back(colorsSize);
+
+				std::vector<std::vector<animated_light_t>> sumesh_partial_bake;
+				for (int16_t meshletNum = 0; meshletNum < lodInfo.meshletCount; meshletNum++) {
+					auto meshlet = (const MeshletInfo*)meshletInfoBytes;
+					meshletInfoBytes += sizeof(MeshletInfo) - 8 ; // (skin ? 0 : 8);
 				
-				Sphere sphere = meshlet->boundingSphere;
-				mat_load((matrix_t*)&gameObject->ltw);
-				float w;
-				mat_trans_nodiv_nomod(sphere.center.x, sphere.center.y, sphere.center.z, sphere.center.x, sphere.center.y, sphere.center.z, w);
-				(void)w;
-				sphere.radius *= gameObject->maxWorldScale;
+					Sphere sphere = meshlet->boundingSphere;
+					mat_load((matrix_t*)&gameObject->ltw);
+					float w;
+					mat_trans_nodiv_nomod(sphere.center.x, sphere.center.y, sphere.center.z, sphere.center.x, sphere.center.y, sphere.center.z, w);
+					(void)w;
+					sphere.radius *= gameObject->maxWorldScale;
 				
-				unsigned selector = meshlet->flags;
-
-				dce_set_mat_decode(
-					meshlet->boundingSphere.radius / 32767.0f,
-					meshlet->boundingSphere.center.x,
-					meshlet->boundingSphere.center.y,
-					meshlet->boundingSphere.center.z
-				);
-				auto colorsBase = colorsSize;
-				colorsSize += meshlet->vertexCount * 3;
-				colors = (uint8_t*)realloc(colors, colorsSize);
-				memset(&colors[colorsBase], 0, meshlet->vertexCount * 3);
+					unsigned selector = meshlet->flags;
+
+					dce_set_mat_decode(
+						meshlet->boundingSphere.radius / 32767.0f,
+						meshlet->boundingSphere.center.x,
+						meshlet->boundingSphere.center.y,
+						meshlet->boundingSphere.center.z
+					);
+					auto colorsBase = colorsSize;
+					colorsSize += meshlet->vertexCount;
+					colors = (uint16_t*)realloc(colors, colorsSize * sizeof(uint16_t));
+					meshletColors.assign(meshlet->vertexCount * 3, 0);
 
-				{
-					unsigned normalOffset = (selector & 8) ? (3 * 2) : (3 * 4);
-					if (selector & 16) {
-						normalOffset += 1 * 2;
-					}
+					{
+						unsigned normalOffset = (selector & 8) ? (3 * 2) : (3 * 4);
+						if (selector & 16) {
+							normalOffset += 1 * 2;
+						}
 
-					normalOffset += (selector & 32) ? 2 : 4;
+						normalOffset += (selector & 32) ? 2 : 4;
 
-					auto normalPointer = &gameObject->mesh->data[meshlet->vertexOffset] + normalOffset;
-					auto vtxSize = meshlet->vertexSize;
+						auto normalPointer = &gameObject->mesh->data[meshlet->vertexOffset] + normalOffset;
+						auto vtxSize = meshlet->vertexSize;
 
-					unsigned smallSelector = ((selector & 8) ? 1 : 0);
+						unsigned smallSelector = ((selector & 8) ? 1 : 0);
 
-					mat_load((matrix_t*)&gameObject->ltw);
-					if (selector & 8) {
-						// mat_load(&mtx);
-						mat_apply(&DCE_MESHLET_MAT_DECODE);
-					} else {
-						// mat_load(&mtx);
-					}
+						mat_load((matrix_t*)&gameObject->ltw);
+						if (selector & 8) {
+							// mat_load(&mtx);
+							mat_apply(&DCE_MESHLET_MAT_DECODE);
+						} else {
+							// mat_load(&mtx);
+						}
 
-					matrix_t mtx;
-					mat_store(&mtx);
-
-					r_matrix_t mtxNormal = localToWorldNormal(gameObject->ltw);
-
-					std::vector<animated_light_t> meshlet_partially_baked;
-
-					for (auto point = point_lights; *point; point++) {
-						/*if ((*point)->gameObject->isActive())*/
-						if (!(*point)->isMovable) {
-							float dist = length(sub((*point)->gameObject->ltw.pos, sphere.center));
-							float maxDist = sphere.radius + (*point)->Range;
-							if (dist < maxDist) {
-								if ((*point)->isAnimated) {
-									auto intensitiesSize = meshlet->vertexCount;
-									auto intensities = (uint8_t*)malloc(intensitiesSize);
-									memset(intensities, 0, intensitiesSize);
-									meshlet_partially_baked.push_back(animated_light_t{*point, (int8_t*)intensities});
-									hasPartialBakes = true;
-									tnlMeshletPointColorPartialBakeSelector[smallSelector](&gameObject->mesh->data[meshlet->vertexOffset], intensities, normalPointer, meshlet->vertexCount, vtxSize, *point, &mtx, (matrix_t*)&mtxNormal);
-
-									for (size_t ii = 0; ii < intensitiesSize; ii++) {
-										intensities[ii] ^= 128;
+						matrix_t mtx;
+						mat_store(&mtx);
+
+						r_matrix_t mtxNormal = localToWorldNormal(gameObject->ltw);
+
+						std::vector<animated_light_t> meshlet_partially_baked;
+
+						for (auto point = point_lights; *point; point++) {
+							/*if ((*point)->gameObject->isActive())*/
+							if (!(*point)->isMovable) {
+								float dist = length(sub((*point)->gameObject->ltw.pos, sphere.center));
+								float maxDist = sphere.radius + (*point)->Range;
+								if (dist < maxDist) {
+									if ((*point)->isAnimated) {
+										auto intensitiesSize = meshlet->vertexCount;
+										auto intensities = (uint8_t*)malloc(intensitiesSize);
+										memset(intensities, 0, intensitiesSize);
+										meshlet_partially_baked.push_back(animated_light_t{*point, (int8_t*)intensities});
+										hasPartialBakes = true;
+										tnlMeshletPointColorPartialBakeSelector[smallSelector](&gameObject->mesh->data[meshlet->vertexOffset], intensities, normalPointer, meshlet->vertexCount, vtxSize, *point, &mtx, (matrix_t*)&mtxNormal);
+
+										for (size_t ii = 0; ii < intensitiesSize; ii++) {
+											intensities[ii] ^= 128;
+										}
+									} else {
+										tnlMeshletPointColorBakeSelector[smallSelector](&gameObject->mesh->data[meshlet->vertexOffset], meshletColors.data(), normalPointer, meshlet->vertexCount, vtxSize, *point, &mtx, (matrix_t*)&mtxNormal);
 									}
-								} else {
-									tnlMeshletPointColorBakeSelector[smallSelector](&gameObject->mesh->data[meshlet->vertexOffset], &colors[colorsBase], normalPointer, meshlet->vertexCount, vtxSize, *point, &mtx, (matrix_t*)&mtxNormal);
 								}
 							}
 						}
-					}
 
-					if (meshlet_partially_baked.size()) {
-						sumesh_partial_bake.push_back(std::move(meshlet_partially_baked));
-					} else {
-						sumesh_partial_bake.emplace_back();
+						packBakedColors(&colors[colorsBase], meshletColors.data(), meshlet->vertexCount);
+
+						if (meshlet_partially_baked.size()) {
+							sumesh_partial_bake.push_back(std::move(meshlet_partially_baked));
+						} else {
+							sumesh_partial_bake.emplace_back();
+						}
 					}
 				}
-			}
 
-			mesh_partial_bake.push_back(std::move(sumesh_partial_bake));
+				mesh_partial_bake.push_back(std::move(sumesh_partial_bake));
+			}
 		}
 	
-		gameObject->bakedColors =(int8_t**)malloc(submesh_colors.size()*sizeof(int8_t*));
+		gameObject->bakedColors =(uint16_t**)malloc(submesh_colors.size()*sizeof(uint16_t*));
 		for (size_t i = 0; i < submesh_colors.size(); i++) {
-			gameObject->bakedColors[i] = (int8_t*)colors + submesh_colors[i];
+			gameObject->bakedColors[i] = colors + submesh_colors[i];
 		}
 
 		if (hasPartialBakes) {
@@ -5209,14 +6053,356 @@ void bakeLights() {
 		} else {
 			gameObject->partiallyBakedColors = nullptr;
 		}
-		
-		for (size_t i = 0; i < colorsSize; i++) {
-			colors[i] = colors[i] ^ 128;
+	}
+}
+
+// bake entries bakeLights makes for go, it stops at the first submesh without a material
+static size_t bakeEntryCount(game_object_t* go) {
+	size_t submeshes = 0;
+	while (submeshes < go->submesh_count && go->materials[submeshes]) {
+		submeshes++;
+	}
+	return submeshes * meshLodLevels;
+}
+
+// fn(bakeNum, meshletNum, meshlet) for every meshlet of the bake entries that aren't lod aliases
+template<typename F>
+static void forEachBakedMeshlet(game_object_t* go, size_t bakeCount, F fn) {
+	const MeshInfo* meshInfo = (const MeshInfo*)&go->mesh->data[0];
+	for (size_t bakeNum = 0; bakeNum < bakeCount; bakeNum++) {
+		if (isLodAlias(meshInfo, bakeNum)) {
+			continue;
+		}
+		auto meshletInfoBytes = &go->mesh->data[meshInfo[bakeNum].meshletOffset];
+		for (int16_t meshletNum = 0; meshletNum < meshInfo[bakeNum].meshletCount; meshletNum++) {
+			fn(bakeNum, meshletNum, (const MeshletInfo*)meshletInfoBytes);
+			meshletInfoBytes += sizeof(MeshletInfo) - 8 ; // (skin ? 0 : 8);
+		}
+	}
+}
+
+static size_t pointLightCount() {
+	size_t count = 0;
+	for (auto point = point_lights; *point; point++) {
+		count++;
+	}
+	return count;
+}
+
+// everything the bake reads from the point lights
+static uint32_t pointLightsHash() {
+	uint32_t hash = fnv1a(nullptr, 0);
+	for (auto point = point_lights; *point; point++) {
+		auto light = *point;
+		uint8_t flags = (light->isMovable ? 1 : 0) | (light->isAnimated ? 2 : 0);
+		hash = fnv1a(&light->gameObject->ltw.pos, sizeof(light->gameObject->ltw.pos), hash);
+		hash = fnv1a(&light->color, sizeof(light->color), hash);
+		hash = fnv1a(&light->intensity, sizeof(light->intensity), hash);
+		hash = fnv1a(&light->Range, sizeof(light->Range), hash);
+		hash = fnv1a(&flags, sizeof(flags), hash);
+	}
+	return hash;
+}
+
+// the arrays loadBakedLighting allocated for go, the colors and intensities live in the file data
+static void freeLoadedBake(game_object_t* go, size_t bakeCount) {
+	free(go->bakedColors);
+	go->bakedColors = nullptr;
+	if (go->partiallyBakedColors) {
+		const MeshInfo* meshInfo = (const MeshInfo*)&go->mesh->data[0];
+		for (size_t bakeNum = 0; bakeNum < bakeCount; bakeNum++) {
+			auto meshletBakes = go->partiallyBakedColors[bakeNum];
+			if (!meshletBakes || isLodAlias(meshInfo, bakeNum)) {
+				continue;
+			}
+			for (int16_t meshletNum = 0; meshletNum < meshInfo[bakeNum].meshletCount; meshletNum++) {
+				free(meshletBakes[meshletNum]);
+			}
+			free(meshletBakes);
+		}
+		free(go->partiallyBakedColors);
+		go->partiallyBakedColors = nullptr;
+	}
+}
+
+// uses the file in place, so it stays allocated. Nothing in the file is trusted, anything that
+// doesn't match the loaded scene and lights leaves every game object unbaked
+static bool loadBakedLighting(const char* file) {
+	std::ifstream in(file, std::ios::binary);
+	if (!in) {
+		return false;
+	}
+	in.seekg(0, std::ios::end);
+	size_t size = in.tellg();
+	in.seekg(0, std::ios::beg);
+
+	if (size < sizeof(baked_lighting_header_t)) {
+		return false;
+	}
+	auto data = (uint8_t*)malloc(size);
+	if (!in.read((char*)data, size)) {
+		std::cout << "Failed to read baked lighting " << file << std::endl;
+		free(data);
+		return false;
+	}
+	auto end = data + size;
+
+	std::vector<std::pair<game_object_t*, size_t>> loaded;
+	auto stale = [&]() {
+		std::cout << "Stale baked lighting " << file << std::endl;
+		for (auto& [go, bakeCount]: loaded) {
+			freeLoadedBake(go, bakeCount);
+		}
+		free(data);
+		return false;
+	};
+
+	auto header = (const baked_lighting_header_t*)data;
+	if (memcmp(header->magic, "DCUEBL03", 8) != 0 || header->gameObjectCount != gameObjects.size() || header->pointLightCount != pointLightCount()
+		|| header->sceneHash != sceneHash || header->lightsHash != pointLightsHash()) {
+		return stale();
+	}
+
+	auto cursor = data + sizeof(baked_lighting_header_t);
+	auto fits = [&](size_t bytes) { return bytes <= size_t(end - cursor); };
+	for (uint32_t objectNum = 0; objectNum < header->objectCount; objectNum++) {
+		if (!fits(sizeof(baked_object_header_t))) {
+			return stale();
+		}
+		auto object = (const baked_object_header_t*)cursor;
+		cursor += sizeof(baked_object_header_t);
+
+		if (object->gameObject >= gameObjects.size()) {
+			return stale();
+		}
+		auto go = gameObjects[object->gameObject];
+		if (!go->mesh || !go->materials || (go->flags & go_movable) || go->bakedColors || object->bakeCount != bakeEntryCount(go)) {
+			return stale();
+		}
+
+		// where every bake entry starts in the colors of the current meshlets
+		const MeshInfo* meshInfo = (const MeshInfo*)&go->mesh->data[0];
+		std::vector<uint32_t> expectedOffsets(object->bakeCount);
+		uint32_t colorsSize = 0;
+		for (size_t bakeNum = 0; bakeNum < object->bakeCount; bakeNum++) {
+			if (isLodAlias(meshInfo, bakeNum)) {
+				expectedOffsets[bakeNum] = expectedOffsets[bakeNum - 1];
+				continue;
+			}
+			expectedOffsets[bakeNum] = colorsSize;
+			auto meshletInfoBytes = &go->mesh->data[meshInfo[bakeNum].meshletOffset];
+			for (int16_t meshletNum = 0; meshletNum < meshInfo[bakeNum].meshletCount; meshletNum++) {
+				colorsSize += ((const MeshletInfo*)meshletInfoBytes)->vertexCount;
+				meshletInfoBytes += sizeof(MeshletInfo) - 8 ; // (skin ? 0 : 8);
+			}
+		}
+		size_t colorsBytes = (colorsSize * sizeof(uint16_t) + 3) & ~3;
+		if (object->colorsSize != colorsSize || !fits(object->bakeCount * sizeof(uint32_t) + colorsBytes)) {
+			return stale();
+		}
+
+		auto colorsOffset = (const uint32_t*)cursor;
+		cursor += object->bakeCount * sizeof(uint32_t);
+		if (memcmp(colorsOffset, expectedOffsets.data(), object->bakeCount * sizeof(uint32_t)) != 0) {
+			return stale();
+		}
+		auto colors = (uint16_t*)cursor;
+		cursor += colorsBytes;
+
+		go->bakedColors = (uint16_t**)malloc(object->bakeCount * sizeof(uint16_t*));
+		go->partiallyBakedColors = nullptr;
+		loaded.emplace_back(go, object->bakeCount);
+		for (size_t i = 0; i < object->bakeCount; i++) {
+			go->bakedColors[i] = colors + colorsOffset[i];
+		}
+
+		if (!object->partialBakes) {
+			continue;
+		}
+
+		// zeroed, so freeLoadedBake can tell what was filled in before the file turned out stale
+		auto meshPartialBakes = (animated_light_t***)calloc(object->bakeCount, sizeof(animated_light_t**));
+		go->partiallyBakedColors = meshPartialBakes;
+		for (size_t bakeNum = 0; bakeNum < object->bakeCount; bakeNum++) {
+			meshPartialBakes[bakeNum] = isLodAlias(meshInfo, bakeNum) ? meshPartialBakes[bakeNum - 1] : (animated_light_t**)calloc(meshInfo[bakeNum].meshletCount, sizeof(animated_light_t*));
+		}
+
+		bool matches = true;
+		forEachBakedMeshlet(go, object->bakeCount, [&](size_t bakeNum, int16_t meshletNum, const MeshletInfo* meshlet) {
+			if (!matches || !fits(2 * sizeof(uint32_t))) {
+				matches = false;
+				return;
+			}
+			auto vertexCount = ((const uint32_t*)cursor)[0];
+			auto lightCount = ((const uint32_t*)cursor)[1];
+			cursor += 2 * sizeof(uint32_t);
+			size_t intensitiesBytes = (meshlet->vertexCount + 3) & ~3;
+			if (vertexCount != meshlet->vertexCount || lightCount > header->pointLightCount || !fits(lightCount * (sizeof(uint32_t) + intensitiesBytes))) {
+				matches = false;
+				return;
+			}
+			if (!lightCount) {
+				return;
+			}
+
+			auto meshletPartialBakes = (animated_light_t*)malloc(sizeof(animated_light_t) * (lightCount + 1));
+			meshPartialBakes[bakeNum][meshletNum] = meshletPartialBakes;
+			for (uint32_t lightNum = 0; lightNum < lightCount; lightNum++) {
+				auto pointLight = *(const uint32_t*)cursor;
+				cursor += sizeof(uint32_t);
+				meshletPartialBakes[lightNum].light = pointLight < header->pointLightCount ? point_lights[pointLight] : nullptr;
+				meshletPartialBakes[lightNum].intensities = (int8_t*)cursor;
+				cursor += intensitiesBytes;
+				matches = matches && meshletPartialBakes[lightNum].light;
+			}
+			meshletPartialBakes[lightCount].light = nullptr;
+		});
+		if (!matches) {
+			return stale();
 		}
 	}
+
+	if (cursor != end) {
+		return stale();
+	}
+	return true;
 }
 
+#if defined(DC_SIM)
+static void writePadded(FILE* f, const void* data, size_t size) {
+	static const uint8_t zeros[3] = { };
+	fwrite(data, 1, size, f);
+	fwrite(zeros, 1, ((size + 3) & ~3) - size, f);
+}
+
+// the bake needs the lights from the generated components, so it runs here rather than in the repacker
+static bool writeBakedLighting(const char* file) {
+	FILE* f = fopen(file, "wb");
+	if (!f) {
+		std::cout << "Failed to open " << file << std::endl;
+		return false;
+	}
+
+	std::vector<uint32_t> bakedObjects;
+	for (size_t i = 0; i < gameObjects.size(); i++) {
+		if (gameObjects[i]->bakedColors && bakeEntryCount(gameObjects[i])) {
+			bakedObjects.push_back(i);
+		}
+	}
+
+	baked_lighting_header_t header = { { 'D', 'C', 'U', 'E', 'B', 'L', '0', '3' }, (uint32_t)gameObjects.size(), (uint32_t)pointLightCount(), (uint32_t)bakedObjects.size(), sceneHash, pointLightsHash() };
+	fwrite(&header, sizeof(header), 1, f);
+
+	for (auto objectNum: bakedObjects) {
+		auto go = gameObjects[objectNum];
+		baked_object_header_t object = { objectNum, (uint32_t)bakeEntryCount(go), 0, go->partiallyBakedColors != nullptr };
+		forEachBakedMeshlet(go, object.bakeCount, [&](size_t, int16_t, const MeshletInfo* meshlet) {
+			object.colorsSize += meshlet->vertexCount;
+		});
+		fwrite(&object, sizeof(object), 1, f);
+
+		for (size_t bakeNum = 0; bakeNum < object.bakeCount; bakeNum++) {
+			uint32_t colorsOffset = go->bakedColors[bakeNum] - go->bakedColors[0];
+			fwrite(&colorsOffset, sizeof(colorsOffset), 1, f);
+		}
+		writePadded(f, go->bakedColors[0], object.colorsSize * sizeof(uint16_t));
+
+		if (!object.partialBakes) {
+			continue;
+		}
+
+		forEachBakedMeshlet(go, object.bakeCount, [&](size_t bakeNum, int16_t meshletNum, const MeshletInfo* meshlet) {
+			auto animatedLights = go->partiallyBakedColors[bakeNum][meshletNum];
+			uint32_t counts[2] = { meshlet->vertexCount, 0 };
+			for (auto animatedLight = animatedLights; animatedLight && animatedLight->light; animatedLight++) {
+				counts[1]++;
+			}
+			uint32_t lightCount = counts[1];
+			fwrite(counts, sizeof(counts), 1, f);
+
+			for (uint32_t lightNum = 0; lightNum < lightCount; lightNum++) {
+				uint32_t pointLight = 0;
+				while (point_lights[pointLight] != animatedLights[lightNum].light) {
+					pointLight++;
+				}
+				fwrite(&pointLight, sizeof(pointLight), 1, f);
+				writePadded(f, animatedLights[lightNum].intensities, meshlet->vertexCount);
+			}
+		});
+	}
+
+	fclose(f);
+	std::cout << "Baked lighting for " << bakedObjects.size() << " objects to " << file << std::endl;
+	return true;
+}
+
+// bakes again on top of the loaded lighting and compares the two
+static bool checkBakedLighting() {
+	struct loaded_bake_t {
+		game_object_t* go;
+		uint16_t** bakedColors;
+		animated_light_t*** partiallyBakedColors;
+	};
+	std::vector<loaded_bake_t> loaded;
+	for (auto go: gameObjects) {
+		if (go->bakedColors) {
+			loaded.push_back({ go, go->bakedColors, go->partiallyBakedColors });
+		}
+	}
+
+	bakeLights();
+
+	size_t mismatches = 0;
+	for (auto& bake: loaded) {
+		auto go = bake.go;
+		auto bakeCount = bakeEntryCount(go);
+
+		size_t colorsSize = 0;
+		forEachBakedMeshlet(go, bakeCount, [&](size_t, int16_t, const MeshletInfo* meshlet) {
+			colorsSize += meshlet->vertexCount;
+		});
+		bool match = memcmp(bake.bakedColors[0], go->bakedColors[0], colorsSize * sizeof(uint16_t)) == 0;
+		for (size_t bakeNum = 0; bakeNum < bakeCount; bakeNum++) {
+			match &= (bake.bakedColors[bakeNum] - bake.bakedColors[0]) == (go->bakedColors[bakeNum] - go->bakedColors[0]);
+		}
+
+		match &= (bake.partiallyBakedColors != nullptr) == (go->partiallyBakedColors != nullptr);
+		if (match && go->partiallyBakedColors) {
+			forEachBakedMeshlet(go, bakeCount, [&](size_t bakeNum, int16_t meshletNum, const MeshletInfo* meshlet) {
+				auto expected = go->partiallyBakedColors[bakeNum][meshletNum];
+				auto actual = bake.partiallyBakedColors[bakeNum][meshletNum];
+				for (; expected && expected->light; expected++, actual++) {
+					match &= actual && actual->light == expected->light && memcmp(actual->intensities, expected->intensities, meshlet->vertexCount) == 0;
+					if (!match) {
+						return;
+					}
+				}
+				match &= !actual || !actual->light;
+			});
+		}
+
+		if (!match) {
+			std::cout << "Baked lighting mismatch on game object " << (std::find(gameObjects.begin(), gameObjects.end(), go) - gameObjects.begin()) << std::endl;
+			mismatches++;
+		}
+	}
+	std::cout << "Checked baked lighting of " << loaded.size() << " objects, " << mismatches << " mismatches" << std::endl;
+	return mismatches == 0;
+}
+#endif
+
 int main(int argc, const char** argv) {
+	#if defined(DC_SIM)
+	if (!parseSimOptions(argc, argv)) {
+		return 1;
+	}
+	if (simOptions.checkAudio) {
+		return check_stream_refills() ? 0 : 1;
+	}
+	if (simOptions.checkAnimations) {
+		return checkAnimationSeek() ? 0 : 1;
+	}
+	#endif
 
     if (pvr_params.fsaa_enabled) {
 		pvr_params.vertex_buf_size = (1024 + 768) * 1024;
@@ -5242,10 +6428,27 @@ int main(int argc, const char** argv) {
 	chdir("repack-data/tlj");
     #endif
 
+	#if defined(DC_SIM)
+	if (simOptions.checkScene) {
+		return checkScene("dream.ndt") ? 0 : 1;
+	}
+	#endif
+
 	loadScene("dream.ndt");
+	for (auto material: materials) {
+		compileMaterialHeaders(material);
+	}
 
     InitializeHierarchy(gameObjects);
+	// parents come first in gameObjects
+	for (auto go: gameObjects) {
+		go->computeActiveState();
+	}
+	initializeStaticBvh();
 	InitializeComponents(gameObjects);
+	for (auto animator: animators) {
+		animator->bind();
+	}
 	InitializeFonts();
 	InitializeFlowMachines();
 	InitializeAudioClips();
@@ -5303,7 +6506,24 @@ int main(int argc, const char** argv) {
 	positionUpdate();
 	physicsUpdate(0.01);
 
-	bakeLights();
+	#if defined(DC_SIM)
+	if (!simOptions.bakeLightsFile.empty()) {
+		bakeLights();
+		return writeBakedLighting(simOptions.bakeLightsFile.c_str()) ? 0 : 1;
+	}
+	#endif
+
+	// baked offline by tlj-sim.elf --bake-lights, only bake here when it's missing or stale
+	bool bakeLoaded = loadBakedLighting("dream.bake");
+	if (!bakeLoaded) {
+		bakeLights();
+	}
+
+	#if defined(DC_SIM)
+	if (simOptions.checkBake) {
+		return bakeLoaded && checkBakedLighting() ? 0 : 1;
+	}
+	#endif
 
 	for (auto go: gameObjects) {
 		if (go->isActive()) {
@@ -5327,6 +6547,16 @@ int main(int argc, const char** argv) {
         
         auto deltaTime = std::chrono::duration_cast<std::chrono::duration<float>>(tp_this_frame - tp_last_frame).count();
         tp_last_frame = tp_this_frame;
+
+		#if defined(DC_SIM)
+		if (simOptions.frames && currentStamp > simOptions.frames) {
+			break;
+		}
+		if (simOptions.fixedDeltaTime != 0) {
+			deltaTime = simOptions.fixedDeltaTime;
+		}
+		memset(&simStats, 0, sizeof(simStats));
+		#endif
         // get input
         auto contMaple = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
         if (contMaple) {
@@ -5474,32 +6704,29 @@ int main(int argc, const char** argv) {
 
         currentCamera->beforeRender(4.0f / 3.0f);
 
-		auto rootNum = roots;
-		do {
-			mergeChildSpheresAndFrustum(currentCamera, gameObjects[*rootNum++]);
-		} while(*rootNum != SIZE_MAX);
+		buildRenderQueues(currentCamera);
 
 		// render frame
 		memset(zBuffer, 0, sizeof(zBuffer));
 		
-		enter_oix(); // renderSelfAndChildren<0> uses OCR_BUFFER for temps
+		enter_oix(); // renderQueue<0> uses OCR_BUFFER for temps
 
-		rootNum = roots;
-		do {
-			renderSelfAndChildren<0>(currentCamera, gameObjects[*rootNum++]);
-		} while(*rootNum != SIZE_MAX);
+		renderQueue<0>(currentCamera);
+		buildZPyramid();
 
 		#if defined(DC_SIM)
-		uint8_t pixBuffer[32][32];
-		for (int y = 0; y < 32; y++) {
-			for (int x = 0; x < 32; x++) {
-				float v = zBuffer[y][x] * 3 * 255;
-				if (v > 255) v = 255;
-				if (v != 0 && v < 32) v = 32;
-				pixBuffer[y][x] = v;
+		if (!simOptions.zbufferFile.empty()) {
+			uint8_t pixBuffer[32][32];
+			for (int y = 0; y < 32; y++) {
+				for (int x = 0; x < 32; x++) {
+					float v = zBuffer[y][x] * 3 * 255;
+					if (v > 255) v = 255;
+					if (v != 0 && v < 32) v = 32;
+					pixBuffer[y][x] = v;
+				}
 			}
+			stbi_write_bmp(simOptions.zbufferFile.c_str(),32,32,1,pixBuffer);
 		}
-		stbi_write_bmp("/home/skmp/projects/dcue/build/zbuffer.bmp",32,32,1,pixBuffer);
 		#endif
 
         pvr_set_zclip(0.0f);
@@ -5507,7 +6734,7 @@ int main(int argc, const char** argv) {
 		pvr_wait_ready();
 		
 		#if defined(DC_SIM)
-		total_idx = 0;
+		auto taBytesStart = emu_ta_bytes;
 		#endif
 
         pvr_scene_begin();
@@ -5516,10 +6743,7 @@ int main(int argc, const char** argv) {
 
 		render_skybox(currentCamera);
 
-		rootNum = roots;
-		do {
-			renderSelfAndChildren<1>(currentCamera, gameObjects[*rootNum++]);
-		} while(*rootNum != SIZE_MAX);
+		renderQueue<1>(currentCamera);
 		
         pvr_list_finish();
 
@@ -5528,22 +6752,18 @@ int main(int argc, const char** argv) {
         pvr_dr_init(&drState);
         pvr_list_begin(PVR_LIST_PT_POLY);
 
-		rootNum = roots;
-		do {
-			renderSelfAndChildren<2>(currentCamera, gameObjects[*rootNum++]);
-		} while(*rootNum != SIZE_MAX);
+		renderQueue<2>(currentCamera);
 		
         pvr_list_finish();
 		
         pvr_dr_init(&drState);
         pvr_list_begin(PVR_LIST_TR_POLY);
-		rootNum = roots;
-		do {
-			renderSelfAndChildren<3>(currentCamera, gameObjects[*rootNum++]);
-		} while(*rootNum != SIZE_MAX);
+		renderQueue<3>(currentCamera);
 		
 		#if defined(DC_SIM)
-		std::cout << total_idx << std::endl;
+		if (!emu_headless) {
+			std::cout << simStats.indices << std::endl;
+		}
 		#endif
 
 		if (overlayImage.alpha != 0) {
@@ -5778,7 +6998,32 @@ int main(int argc, const char** argv) {
 
         leave_oix();
         pvr_scene_finish();
+
+		#if defined(DC_SIM)
+		if (simOptions.stats) {
+			pvr_stats_t pvrStats;
+			pvr_get_stats(&pvrStats);
+			fprintf(simOptions.stats, "%u,%f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%llu,%u\n",
+				currentStamp, deltaTime,
+				simStats.objectsDrawn, simStats.objectsOccluded,
+				simStats.meshletsDrawn, simStats.meshletsCulled, simStats.meshletsBackfaced, simStats.indices,
+				simStats.occludersDrawn, simStats.occludersSkipped, simStats.occluderQuads,
+				simStats.polyHeaders, simStats.polyHeadersSaved,
+				(unsigned long long)(emu_ta_bytes - taBytesStart), (unsigned)pvrStats.vtx_buffer_used);
+		}
+		if (simOptions.dumpFrames.count(currentStamp)) {
+			char dumpName[32];
+			snprintf(dumpName, sizeof(dumpName), "%05u.png", currentStamp);
+			emu_dump_frame((simOptions.dumpPrefix + dumpName).c_str());
+		}
+		#endif
     }
 
+	#if defined(DC_SIM)
+	if (simOptions.stats) {
+		fclose(simOptions.stats);
+	}
+	#endif
+
     pvr_shutdown();
 }
\ No newline at end of file
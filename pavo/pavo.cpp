@@ -139,6 +139,7 @@ Task pavo_unit_audio_source_play_t::enter() {
 
 Task pavo_unit_mesh_renderer_set_enabled_t::enter() {
     gameObjects[targetGameObjectIndex]->mesh_enabled = setTo;
+    gameObjects[targetGameObjectIndex]->markMeshDirty();
     return onExit->enter();
 }
 
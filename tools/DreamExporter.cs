@@ -1390,7 +1390,7 @@ public class DreamExporter : MonoBehaviour
 
         sb.AppendLine("void InitializeComponents(std::vector<game_object_t*> gameObjects) {");
         sb.AppendLine(" for (size_t gameObjectNum = 0; gameObjectNum < gameObjects.size(); gameObjectNum++) {");
-        sb.AppendLine("  gameObjects[gameObjectNum]->components = components[gameObjectNum];");
+        sb.AppendLine("  gameObjects[gameObjectNum]->setComponents(components[gameObjectNum]);");
         sb.AppendLine("  component_t* currentComponentList = components[gameObjectNum];");
         sb.AppendLine("  while (currentComponentList->componentType != ct_eol)");
         sb.AppendLine("  {");
@@ -1634,6 +1634,117 @@ public class DreamExporter : MonoBehaviour
         File.WriteAllText("hierarchy.cpp", sb.ToString());
     }
 
+    // largest error a dropped key may introduce, in the property's own units
+    static float AnimationKeyTolerance(AnimationPropertyKey key)
+    {
+        switch (key)
+        {
+            case AnimationPropertyKey.Transform_localEulerAnglesRaw_x:
+            case AnimationPropertyKey.Transform_localEulerAnglesRaw_y:
+            case AnimationPropertyKey.Transform_localEulerAnglesRaw_z:
+                return 0.01f;
+            default:
+                return 0.0005f;
+        }
+    }
+
+    // The runtime interpolates linearly between keys, so any key that the line between
+    // its kept neighbours reproduces within tolerance is dropped. Constant curves end up
+    // with a single key.
+    // Boolean tracks are stepped, their setters only look at the current key's value, so a
+    // key is only dropped when it repeats the value of the key kept before it.
+    static List<Keyframe> ReduceLinearKeys(Keyframe[] keys, AnimationPropertyType type, float tolerance)
+    {
+        var kept = new List<Keyframe>();
+        if (keys.Length == 0)
+        {
+            return kept;
+        }
+
+        if (type == AnimationPropertyType.Boolean)
+        {
+            kept.Add(keys[0]);
+            for (int i = 1; i < keys.Length; i++)
+            {
+                if (keys[i].value != kept[kept.Count - 1].value)
+                {
+                    kept.Add(keys[i]);
+                }
+            }
+            return kept;
+        }
+
+        float min = keys.Min(k => k.value), max = keys.Max(k => k.value);
+        if (max - min <= tolerance)
+        {
+            kept.Add(keys[0]);
+            return kept;
+        }
+
+        kept.Add(keys[0]);
+        int start = 0;
+        for (int i = 1; i < keys.Length - 1; i++)
+        {
+            var end = keys[i + 1];
+            for (int k = start + 1; k <= i; k++)
+            {
+                float t = (keys[k].time - keys[start].time) / (end.time - keys[start].time);
+                float value = keys[start].value + t * (end.value - keys[start].value);
+                if (Mathf.Abs(value - keys[k].value) > tolerance)
+                {
+                    kept.Add(keys[i]);
+                    start = i;
+                    break;
+                }
+            }
+        }
+        kept.Add(keys[keys.Length - 1]);
+
+        return kept;
+    }
+
+    // 16 bit key times, time = q * timeScale. Keys stay strictly increasing so segments never have zero length.
+    static ushort[] QuantizeKeyTimes(List<Keyframe> keys, float timeScale)
+    {
+        var rv = new ushort[keys.Count];
+        int last = -1;
+        for (int i = 0; i < keys.Count; i++)
+        {
+            int q = Mathf.Clamp(Mathf.RoundToInt(keys[i].time / timeScale), last + 1, 65535);
+            if (q <= last)
+            {
+                throw new Exception($"Too many keys to quantize at time {keys[i].time}");
+            }
+            rv[i] = (ushort)q;
+            last = q;
+        }
+        return rv;
+    }
+
+    // 16 bit key values, value = offset + q * scale. Integer valued curves (toggles, indices) use a scale of 1 so they decode exactly.
+    static ushort[] QuantizeKeyValues(List<Keyframe> keys, out float offset, out float scale)
+    {
+        float min = keys.Min(k => k.value), max = keys.Max(k => k.value);
+        bool integral = keys.All(k => k.value == Mathf.Round(k.value)) && max - min <= 65535;
+
+        offset = min;
+        if (integral || max == min)
+        {
+            scale = 1;
+        }
+        else
+        {
+            scale = (max - min) / 65535;
+        }
+
+        var rv = new ushort[keys.Count];
+        for (int i = 0; i < keys.Count; i++)
+        {
+            rv[i] = (ushort)Mathf.Clamp(Mathf.RoundToInt((keys[i].value - offset) / scale), 0, 65535);
+        }
+        return rv;
+    }
+
     static void ProcessAnimations(DreamScene ds)
     {
 
@@ -1701,14 +1812,16 @@ public class DreamExporter : MonoBehaviour
         }
 
         var animationClipsList = new List<AnimationClip>(animationClips);
+        int totalKeys = 0, keptKeys = 0;
         var animationClipIndex = new Dictionary<AnimationClip,  int>();
         /*
          * Animation anim_%i = {
          *  {
          *   {
-         *    { times... },
-         *    { values... },
-         *    num_frames, offset,
+         *    { quantized times... },
+         *    { quantized values... },
+         *    num_keys, property_key,
+         *    timeScale, valueOffset, valueScale,
          *   },
          *  ....
          *  },
@@ -1733,6 +1846,9 @@ public class DreamExporter : MonoBehaviour
 
             var timesValuesToName = new Dictionary<string, string>();
 
+            // all tracks share the clip's time scale so identical key times can share one array
+            float timeScale = animationClip.length > 0 ? animationClip.length / 65535 : 1;
+
             int numTargets = 0;
             for (int curveBindingNum = 0; curveBindingNum < curveBindings.Length; curveBindingNum++)
             {
@@ -1753,7 +1869,7 @@ public class DreamExporter : MonoBehaviour
                     continue;
                 }
 
-                if (propertyKeyInfo.type != AnimationPropertyType.Float)
+                if (propertyKeyInfo.type != AnimationPropertyType.Float && propertyKeyInfo.type != AnimationPropertyType.Boolean)
                 {
                     throw new Exception("Unsupported propertyKeyInfo");
                 }
@@ -1763,13 +1879,19 @@ public class DreamExporter : MonoBehaviour
 
                 animationStringBuilder.AppendLine(" {");
 
+                var keys = ReduceLinearKeys(curve.keys, propertyKeyInfo.type, AnimationKeyTolerance(propertyKeyInfo.key));
+                var quantizedTimes = QuantizeKeyTimes(keys, timeScale);
+                var quantizedValues = QuantizeKeyValues(keys, out var valueOffset, out var valueScale);
+
+                totalKeys += curve.keys.Length;
+                keptKeys += keys.Count;
+
                 StringBuilder timesStringBuilder = new StringBuilder();
 
                 timesStringBuilder.Append($" = {{");
-                // Enumerate through all keyframes in this curve
-                foreach (Keyframe key in curve.keys)
+                foreach (var time in quantizedTimes)
                 {
-                    timesStringBuilder.Append($"{key.time}, ");
+                    timesStringBuilder.Append($"{time}, ");
                 }
                 timesStringBuilder.AppendLine("};");
 
@@ -1778,7 +1900,7 @@ public class DreamExporter : MonoBehaviour
                 if (!timesValuesToName.ContainsKey(timesString))
                 {
                     string name = $"anim_{animationClipNum}_track_{curveBindingNum}_times";
-                    sb.Append("float ");
+                    sb.Append("uint16_t ");
                     sb.Append(name);
                     sb.Append("[]");
                     sb.AppendLine(timesString);
@@ -1786,18 +1908,18 @@ public class DreamExporter : MonoBehaviour
                     timesValuesToName.Add(timesString, name);
                 }
 
-                sb.Append($"float anim_{animationClipNum}_track_{curveBindingNum}_values[] = {{");
-                // Enumerate through all keyframes in this curve
-                foreach (Keyframe key in curve.keys)
+                sb.Append($"uint16_t anim_{animationClipNum}_track_{curveBindingNum}_values[] = {{");
+                foreach (var value in quantizedValues)
                 {
-                    sb.Append($"{key.value}, ");
+                    sb.Append($"{value}, ");
                 }
                 sb.AppendLine("};");
 
                 
                 animationStringBuilder.AppendLine($"  {timesValuesToName[timesString]},");
                 animationStringBuilder.AppendLine($"  anim_{animationClipNum}_track_{curveBindingNum}_values,");
-                animationStringBuilder.AppendLine($"  {curve.keys.Length}, {propertyKeyInfo.key},");
+                animationStringBuilder.AppendLine($"  {keys.Count}, {propertyKeyInfo.key},");
+                animationStringBuilder.AppendLine($"  {timeScale}, {valueOffset}, {valueScale},");
 
                 animationStringBuilder.AppendLine(" },");
             }
@@ -1813,6 +1935,8 @@ public class DreamExporter : MonoBehaviour
             sb.AppendLine(animationStringBuilder.ToString());
         }
 
+        Debug.Log($"Animations: kept {keptKeys} of {totalKeys} keys");
+
         for (int animatorNum = 0; animatorNum < animators.Count; animatorNum++)
         {
             var animator = animators[animatorNum];
@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <cmath>
+#include <cfloat>
 #include <cstdint>
 #include <cstddef>
 #include <vector>
@@ -17,8 +18,13 @@
 #include <unordered_map>
 #include <set>
 #include <list>
+#include <queue>
+#include <tuple>
 
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include "dcue/types-import.h"
 #include "dcue/types-native.h"
@@ -1061,64 +1067,484 @@ struct meshlet {
 
 		return sphere;
 	}
+
+	// Triangles in the winding the hardware sees, odd strip triangles flipped back
+	std::vector<std::array<uint16_t, 3>> triangles() const {
+		std::vector<std::array<uint16_t, 3>> rv;
+		for (auto&& strip: strips) {
+			auto& idx = strip->Indices;
+			if (strip->Type == triangle_stripper::TRIANGLES) {
+				for (size_t i = 0; i + 2 < idx.size(); i += 3) {
+					rv.push_back({ idx[i], idx[i + 1], idx[i + 2] });
+				}
+			} else {
+				for (size_t i = 0; i + 2 < idx.size(); i++) {
+					if (i & 1) {
+						rv.push_back({ idx[i + 1], idx[i], idx[i + 2] });
+					} else {
+						rv.push_back({ idx[i], idx[i + 1], idx[i + 2] });
+					}
+				}
+			}
+		}
+		return rv;
+	}
+
+	// Normal cone of the triangles, quantized conservatively. renderMesh culls CCW, or CW for mirrored
+	// objects, and either way keeps exactly the triangles whose cross(b - a, c - a) points towards the
+	// camera in object space, so that is the front side whatever the vertex normals say
+	void calculateNormalCone(V3d* vertexData, int8_t coneAxis[3], int8_t* coneCutoff) {
+		coneAxis[0] = coneAxis[1] = coneAxis[2] = 0;
+		*coneCutoff = 127;
+
+		std::vector<V3d> normals;
+		for (auto&& tri: triangles()) {
+			V3d n = cross(sub(vertexData[tri[1]], vertexData[tri[0]]), sub(vertexData[tri[2]], vertexData[tri[0]]));
+			float len = length(n);
+			if (len > 0) {
+				normals.push_back(scale(n, 1 / len));
+			}
+		}
+
+		if (normals.empty()) {
+			return;
+		}
+
+		V3d axis = { 0, 0, 0 };
+		for (auto&& n: normals) {
+			axis = add(axis, n);
+		}
+		if (length(axis) < 1e-6f) {
+			return;
+		}
+		axis = normalize(axis);
+
+		// truncated, so the runtime never sees an axis longer than the real one
+		int8_t q[3] = { (int8_t)(axis.x * 127), (int8_t)(axis.y * 127), (int8_t)(axis.z * 127) };
+		V3d qAxis = normalize(V3d{ (float)q[0], (float)q[1], (float)q[2] });
+
+		float minDot = 1;
+		for (auto&& n: normals) {
+			minDot = std::min(minDot, dot(qAxis, n));
+		}
+		// wider than a hemisphere, some triangle always faces the camera
+		if (minDot <= 0) {
+			return;
+		}
+
+		int cutoff = (int)ceilf(sqrtf(1 - minDot * minDot) * 127);
+		if (cutoff >= 127) {
+			return;
+		}
+
+		coneAxis[0] = q[0];
+		coneAxis[1] = q[1];
+		coneAxis[2] = q[2];
+		*coneCutoff = cutoff;
+	}
+
+	// Places cameras around the meshlet and checks that wherever renderMesh's cone test rejects it,
+	// the hardware would have culled every triangle by winding as well
+	bool coneCullsOnlyBackfaces(V3d* vertexData, const Sphere& sphere, const int8_t coneAxis[3], int8_t coneCutoff) const {
+		if (coneCutoff == 127) {
+			return true;
+		}
+		auto tris = triangles();
+		constexpr int directions = 64;
+		for (float distance: { 1.01f, 1.5f, 4.f, 20.f }) {
+			for (int d = 0; d < directions; d++) {
+				// fibonacci sphere
+				float y = 1 - (d + 0.5f) * 2 / directions;
+				float r = sqrtf(1 - y * y);
+				float phi = d * 2.39996323f;
+				V3d dir = { cosf(phi) * r, y, sinf(phi) * r };
+				V3d cam = add(sphere.center, scale(dir, sphere.radius * distance + 0.01f));
+
+				// same as renderMesh
+				V3d toMeshlet = sub(sphere.center, cam);
+				float axisDot = (toMeshlet.x * coneAxis[0] + toMeshlet.y * coneAxis[1] + toMeshlet.z * coneAxis[2]) * (1.0f / 127.0f);
+				if (axisDot < coneCutoff * (1.0f / 127.0f) * length(toMeshlet) + sphere.radius) {
+					continue;
+				}
+
+				for (auto&& tri: tris) {
+					V3d n = cross(sub(vertexData[tri[1]], vertexData[tri[0]]), sub(vertexData[tri[2]], vertexData[tri[0]]));
+					if (dot(n, sub(cam, vertexData[tri[0]])) > 0) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
 };
+constexpr size_t meshletMaxVertices = 128;
+// meshopt clusters, <= 255 and a multiple of 4 for all meshoptimizer versions
+constexpr size_t meshletMaxTriangles = 252;
+// meshopt_simplify error limit per lod level, relative to the mesh extents
+constexpr float meshLodMaxError[native::meshLodLevels] = { 0.0f, 0.02f, 0.05f };
+
+struct meshlet_stats_t {
+	size_t meshlets;
+	size_t vertices;
+	size_t indices;
+	size_t minVertices;
+};
+
+// Greedy meshlet builder. Grows a meshlet from the strips that share vertices with it, preferring
+// strips that add no new vertices, then the ones with the most shared indices. When no adjacent
+// strip fits, continues with the spatially nearest strip that does, via a grid of strip centroids.
+static std::vector<meshlet> buildMeshlets(std::vector<triangle_stripper::primitive_group>& prims, const V3d* vertices, meshlet_stats_t* stats) {
+	std::vector<meshlet> meshlets;
+
+	size_t stripCount = prims.size();
+	if (stripCount == 0) {
+		return meshlets;
+	}
+
+	// strip -> unique vertices with use counts, vertex -> strips
+	std::vector<std::vector<std::pair<uint16_t, uint16_t>>> stripVertices(stripCount);
+	std::unordered_map<uint16_t, std::vector<std::pair<uint32_t, uint16_t>>> vertexStrips;
+	std::vector<V3d> stripCentroids(stripCount);
+
+	for (uint32_t s = 0; s < stripCount; s++) {
+		std::map<uint16_t, uint16_t> counts;
+		for (auto idx: prims[s].Indices) {
+			counts[idx]++;
+		}
+		V3d centroid = {0, 0, 0};
+		for (auto [idx, count]: counts) {
+			stripVertices[s].push_back({idx, count});
+			vertexStrips[idx].push_back({s, count});
+			centroid = add(centroid, vertices[idx]);
+		}
+		stripCentroids[s] = { centroid.x / counts.size(), centroid.y / counts.size(), centroid.z / counts.size() };
+	}
+
+	// uniform grid over strip centroids, ~1 strip per cell
+	V3d gridMin = stripCentroids[0], gridMax = stripCentroids[0];
+	for (auto& c: stripCentroids) {
+		gridMin = { std::min(gridMin.x, c.x), std::min(gridMin.y, c.y), std::min(gridMin.z, c.z) };
+		gridMax = { std::max(gridMax.x, c.x), std::max(gridMax.y, c.y), std::max(gridMax.z, c.z) };
+	}
+	int gridDim = std::max(1, (int)std::cbrt((float)stripCount));
+	V3d gridSize = sub(gridMax, gridMin);
+	auto gridCoord = [&](float v, float min, float size) {
+		return size > 0 ? std::clamp((int)((v - min) / size * gridDim), 0, gridDim - 1) : 0;
+	};
+	auto gridCell = [&](const V3d& p, int* cx, int* cy, int* cz) {
+		*cx = gridCoord(p.x, gridMin.x, gridSize.x);
+		*cy = gridCoord(p.y, gridMin.y, gridSize.y);
+		*cz = gridCoord(p.z, gridMin.z, gridSize.z);
+	};
+	std::vector<std::vector<uint32_t>> grid(gridDim * gridDim * gridDim);
+	for (uint32_t s = 0; s < stripCount; s++) {
+		int cx, cy, cz;
+		gridCell(stripCentroids[s], &cx, &cy, &cz);
+		grid[(cz * gridDim + cy) * gridDim + cx].push_back(s);
+	}
+
+	std::vector<bool> stripUsed(stripCount, false);
+	std::multiset<size_t> remainingUniqueCounts;
+	for (auto& sv: stripVertices) {
+		remainingUniqueCounts.insert(sv.size());
+	}
+
+	// per meshlet state, reset through meshletStamp
+	std::vector<uint32_t> stripStamp(stripCount, 0);
+	std::vector<uint32_t> stripShared(stripCount);
+	std::vector<uint32_t> stripNew(stripCount);
+	std::unordered_map<uint16_t, uint32_t> vertexStamp;
+	uint32_t meshletStamp = 0;
+
+	auto newVertices = [&](uint32_t s) {
+		return stripStamp[s] == meshletStamp ? stripNew[s] : stripVertices[s].size();
+	};
+
+	// (no new vertices, shared indices), strip, shared at push time
+	using candidate_t = std::tuple<bool, uint32_t, uint32_t>;
+	std::priority_queue<std::pair<candidate_t, uint32_t>> candidates;
+
+	size_t stripsLeft = stripCount;
+	size_t seedCursor = 0;
+
+	while (stripsLeft) {
+		meshletStamp++;
+		candidates = {};
+
+		std::set<uint16_t> meshletVertices;
+		std::vector<triangle_stripper::primitive_group*> meshletStrips;
+		V3d meshletSum = {0, 0, 0};
+
+		auto addStrip = [&](uint32_t s) {
+			stripUsed[s] = true;
+			stripsLeft--;
+			remainingUniqueCounts.erase(remainingUniqueCounts.find(stripVertices[s].size()));
+			meshletStrips.push_back(&prims[s]);
+
+			for (auto [idx, count]: stripVertices[s]) {
+				auto& stamp = vertexStamp[idx];
+				if (stamp == meshletStamp) {
+					continue;
+				}
+				stamp = meshletStamp;
+				meshletVertices.insert(idx);
+				meshletSum = add(meshletSum, vertices[idx]);
+
+				for (auto [other, otherCount]: vertexStrips[idx]) {
+					if (stripUsed[other]) {
+						continue;
+					}
+					if (stripStamp[other] != meshletStamp) {
+						stripStamp[other] = meshletStamp;
+						stripShared[other] = 0;
+						stripNew[other] = stripVertices[other].size();
+					}
+					stripShared[other] += otherCount;
+					stripNew[other]--;
+					candidates.push({{stripNew[other] == 0, stripShared[other], other}, stripShared[other]});
+				}
+			}
+		};
+
+		auto nearestFitting = [&](size_t remaining) -> int64_t {
+			if (remainingUniqueCounts.empty() || *remainingUniqueCounts.begin() > remaining) {
+				return -1;
+			}
+			V3d center = { meshletSum.x / meshletVertices.size(), meshletSum.y / meshletVertices.size(), meshletSum.z / meshletVertices.size() };
+			int cx, cy, cz;
+			gridCell(center, &cx, &cy, &cz);
+
+			// expanding shells of cells, nearest centroid wins within the first shell that has a fit
+			for (int r = 0; r < gridDim; r++) {
+				int64_t best = -1;
+				float bestDistance = FLT_MAX;
+				for (int z = std::max(0, cz - r); z <= std::min(gridDim - 1, cz + r); z++) {
+					for (int y = std::max(0, cy - r); y <= std::min(gridDim - 1, cy + r); y++) {
+						for (int x = std::max(0, cx - r); x <= std::min(gridDim - 1, cx + r); x++) {
+							if (std::max({abs(x - cx), abs(y - cy), abs(z - cz)}) != r) {
+								continue;
+							}
+							auto& cell = grid[(z * gridDim + y) * gridDim + x];
+							for (size_t i = 0; i < cell.size(); i++) {
+								auto s = cell[i];
+								if (stripUsed[s]) {
+									// drop used strips from the cell
+									cell[i--] = cell.back();
+									cell.pop_back();
+									continue;
+								}
+								if (newVertices(s) > remaining) {
+									continue;
+								}
+								float distance = length(sub(stripCentroids[s], center));
+								if (distance < bestDistance) {
+									bestDistance = distance;
+									best = s;
+								}
+							}
+						}
+					}
+				}
+				if (best != -1) {
+					return best;
+				}
+			}
+			return -1;
+		};
+
+		// seed with the first unused strip, in stripper order
+		while (stripUsed[seedCursor]) {
+			seedCursor++;
+		}
+		assert(stripVertices[seedCursor].size() <= meshletMaxVertices);
+		addStrip(seedCursor);
+
+		for (;;) {
+			size_t remaining = meshletMaxVertices - meshletVertices.size();
+			int64_t next = -1;
+
+			while (candidates.size()) {
+				auto [key, shared] = candidates.top();
+				auto s = std::get<2>(key);
+				candidates.pop();
+
+				// stale entry, a newer one was pushed when the strip changed
+				if (stripUsed[s] || shared != stripShared[s]) {
+					continue;
+				}
+				// does not fit, remaining only shrinks until the strip changes again
+				if (stripNew[s] > remaining) {
+					continue;
+				}
+				next = s;
+				break;
+			}
+
+			if (next == -1) {
+				next = nearestFitting(remaining);
+			}
+
+			if (next == -1) {
+				break;
+			}
+
+			addStrip(next);
+		}
+
+		assert(meshletVertices.size() <= meshletMaxVertices);
+
+		meshlets.push_back(meshlet{meshletVertices, {}, meshletStrips, 0, 0});
+
+		uint8_t localIndex = 0;
+		for (auto &&idx: meshletVertices) {
+			meshlets.back().vertexToLocalIndex[idx] = localIndex++;
+		}
+
+		stats->meshlets++;
+		stats->vertices += meshletVertices.size();
+		stats->minVertices = std::min(stats->minVertices, meshletVertices.size());
+		for (auto &&strip: meshletStrips) {
+			stats->indices += strip->Indices.size();
+		}
+	}
+
+	return meshlets;
+}
+
+// Cluster the triangles into meshlet sized groups with few unique vertices, then strip each
+// group on its own. Strips never straddle a cluster, so buildMeshlets can pack them without
+// duplicating vertices across meshlets
+static void stripClusters(const std::vector<unsigned int>& triangles, const float* positions, size_t vertexCount, triangle_stripper::primitive_vector& out) {
+	using namespace triangle_stripper;
+
+	size_t maxClusters = meshopt_buildMeshletsBound(triangles.size(), meshletMaxVertices, meshletMaxTriangles);
+	std::vector<meshopt_Meshlet> clusters(maxClusters);
+	std::vector<unsigned int> clusterVertices(maxClusters * meshletMaxVertices);
+	std::vector<unsigned char> clusterTriangles(maxClusters * meshletMaxTriangles * 3);
+
+	size_t clusterCount = meshopt_buildMeshlets(
+		clusters.data(), clusterVertices.data(), clusterTriangles.data(),
+		triangles.data(), triangles.size(),
+		positions, vertexCount, sizeof(float) * 3,
+		meshletMaxVertices, meshletMaxTriangles, 0.0f
+	);
+
+	for (size_t clusterNum = 0; clusterNum < clusterCount; clusterNum++) {
+		auto& cluster = clusters[clusterNum];
+
+		indices Indices;
+		for (size_t i = 0; i < cluster.triangle_count * 3; i++) {
+			Indices.push_back(clusterVertices[cluster.vertex_offset + clusterTriangles[cluster.triangle_offset + i]]);
+		}
+
+		tri_stripper TriStripper(Indices);
+
+		TriStripper.SetMinStripSize(0);
+		TriStripper.SetCacheSize(0);
+		TriStripper.SetBackwardSearch(true);
+
+		primitive_vector clusterStrips;
+		TriStripper.Strip(&clusterStrips);
+
+		out.insert(out.end(), clusterStrips.begin(), clusterStrips.end());
+	}
+}
+
 struct compressed_mesh_t {
 	Sphere bounding_sphere;
 	std::vector<uint8_t> quadData;
 	std::vector<uint8_t> data;
 };
 
-compressed_mesh_t process_mesh(mesh_t *mesh) {
-	using namespace triangle_stripper;
-	
-	int32 n = mesh->submesh_count + mesh->logical_submesh_count;
-	std::vector<primitive_vector> pvecs(n);
-	std::vector<std::vector<meshlet>> meshMeshlets(n);
+// Exact attribute match on the float bit patterns, so -ffast-math can't change which
+// vertices merge. -0 is folded into +0 and NaN never matches, same as float ==
+struct MeshVertexKey {
+	uint32_t bits[8];   // position, normal, texcoord
+	uint32_t color;
 
-	size_t totalIndices = 0, strips = 0,  totalTrilist = 0;
+	static uint32_t canonicalBits(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return (bits & 0x7fffffff) == 0 ? 0 : bits;
+	}
 
-	bool colored = mesh->col != nullptr;
-	bool normaled = mesh->normals != nullptr;
-	bool texcoorded = mesh->uv != nullptr;
-	
-	Sphere boundingSphere = calculateBoundingSphere((V3d*)mesh->vertices, mesh->vertex_count);
+	MeshVertexKey(const mesh_t *mesh, size_t vertex) {
+		float values[8] = { };
+		memcpy(values, &mesh->vertices[vertex * 3], sizeof(float) * 3);
+		if (mesh->normals) {
+			memcpy(values + 3, &mesh->normals[vertex * 3], sizeof(float) * 3);
+		}
+		if (mesh->uv) {
+			memcpy(values + 6, &mesh->uv[vertex * 2], sizeof(float) * 2);
+		}
+		for (int i = 0; i < 8; i++) {
+			bits[i] = canonicalBits(values[i]);
+		}
+		color = mesh->col ? ((RGBA*)mesh->col)[vertex].raw : 0;
+	}
 
-	auto vertices = (V3d*)mesh->vertices;
-	auto normals = (V3d*)mesh->normals;
-	auto texcoords = (TexCoords*)mesh->uv;
-	auto colors = (RGBA*)mesh->col;
+	bool comparable() const {
+		for (int i = 0; i < 8; i++) {
+			if ((bits[i] & 0x7f800000) == 0x7f800000 && (bits[i] & 0x007fffff) != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool operator==(const MeshVertexKey &other) const {
+		return memcmp(bits, other.bits, sizeof(bits)) == 0 && color == other.color;
+	}
+};
+
+struct MeshVertexKeyHash {
+	std::size_t operator()(const MeshVertexKey &key) const {
+		std::size_t hash = key.color;
+		for (int i = 0; i < 8; i++) {
+			hash = hash * 31 + key.bits[i];
+		}
+		return hash;
+	}
+};
+
+// canonical vertex is the first one with identical attributes
+static std::vector<size_t> canonicalVertices(const mesh_t *mesh) {
+	std::vector<size_t> canonicalIdx(mesh->vertex_count);
+	std::unordered_map<MeshVertexKey, size_t, MeshVertexKeyHash> firstVertex;
+	firstVertex.reserve(mesh->vertex_count);
+	for (size_t i = 0; i < mesh->vertex_count; i++) {
+		MeshVertexKey key(mesh, i);
 
+		// NaN never compares equal, so such vertices are never merged
+		if (!key.comparable()) {
+			canonicalIdx[i] = i;
+			continue;
+		}
+
+		canonicalIdx[i] = firstVertex.emplace(key, i).first->second;
+	}
+	return canonicalIdx;
+}
+
+// The pairwise scan canonicalVertices replaced, only kept as the reference for --check-dedup
+static std::vector<size_t> canonicalVerticesPairwise(const mesh_t *mesh) {
 	std::vector<size_t> canonicalIdx(mesh->vertex_count, SIZE_MAX);
 	for (size_t i = 0; i < mesh->vertex_count; i++) {
+		MeshVertexKey vi(mesh, i);
 		for (size_t j = i+1; j < mesh->vertex_count; j++) {
-			bool duplicate = true;
-			if (vertices[i].x != vertices[j].x || vertices[i].y != vertices[j].y || vertices[i].z != vertices[j].z) {
-				duplicate = false;
-			}
-
-			if (texcoorded && (texcoords[i].u != texcoords[j].u || texcoords[i].v != texcoords[j].v)) {
-				duplicate = false;
-			}
-			if (normaled && (normals[i].x != normals[j].x || normals[i].y != normals[j].y || normals[i].z != normals[j].z)) {
-				duplicate = false;
-			}
-			if (colored && (colors[i].red != colors[j].red || colors[i].green != colors[j].green || colors[i].blue != colors[j].blue || colors[i].alpha != colors[j].alpha)) {
-				duplicate = false;
-			}
+			MeshVertexKey vj(mesh, j);
+			bool duplicate = vi.comparable() && vj.comparable() && vi == vj;
 			if (duplicate) {
-				// texconvf("Vertex %zu: %.2f %.2f %.2f deemed dup with %zu: %.2f %.2f %.2f\n", i, vertices[i].x, vertices[i].y, vertices[i].z, j, vertices[j].x, vertices[j].y, vertices[j].z);
 				if(canonicalIdx[i] == SIZE_MAX) {
 					if (canonicalIdx[j] != SIZE_MAX) {
 						canonicalIdx[i] = canonicalIdx[j];
-						// texconvf("Warning: Duplicate Chain vertex %zu and %zu\n", i, j);
 					} else {
 						canonicalIdx[i] = i;
 						canonicalIdx[j] = i;
-						// texconvf("Warning: Duplicate vertex %zu and %zu\n", i, j);
 					}
 				} else {
 					canonicalIdx[j] = canonicalIdx[i];
-					// texconvf("Warning: Duplicate Double vertex %zu and %zu\n", i, j);
 				}
 			}
 		}
@@ -1126,6 +1552,79 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
 			canonicalIdx[i] = i;
 		}
 	}
+	return canonicalIdx;
+}
+
+// repacker.elf --check-dedup: canonicalVertices against the pairwise scan on synthetic meshes
+// with many exact duplicates, signed zeros, NaNs and each optional attribute missing
+static bool checkVertexDedup() {
+	uint32_t seed = 1;
+	auto next = [&seed]() {
+		seed = seed * 1664525 + 1013904223;
+		return seed >> 8;
+	};
+	const float pool[] = { 0.f, -0.f, 1.f, -1.f, 0.5f, 0.25f, 3.f, NAN, -NAN, 1e-30f };
+	constexpr size_t poolSize = sizeof(pool) / sizeof(pool[0]);
+
+	for (int meshNum = 0; meshNum < 200; meshNum++) {
+		size_t vertexCount = 1 + next() % 400;
+		bool normaled = meshNum % 4 != 1, texcoorded = meshNum % 4 != 2, colored = meshNum % 4 != 3;
+		// small pools make lots of duplicates, later meshes mostly unique ones
+		size_t variety = 2 + meshNum % 5 * (meshNum < 100 ? 1 : 40);
+
+		std::vector<float> vertices(vertexCount * 3), normals(vertexCount * 3), uvs(vertexCount * 2);
+		std::vector<RGBA> colors(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			auto value = [&]() { return next() % 8 == 0 ? pool[next() % poolSize] : (float)(next() % variety); };
+			for (int c = 0; c < 3; c++) {
+				vertices[i * 3 + c] = value();
+				normals[i * 3 + c] = value();
+			}
+			uvs[i * 2] = value();
+			uvs[i * 2 + 1] = value();
+			colors[i].raw = next() % variety;
+		}
+
+		mesh_t mesh(0, 0, nullptr, vertexCount, vertices.data(), texcoorded ? uvs.data() : nullptr,
+			colored ? (uint8_t*)colors.data() : nullptr, normaled ? normals.data() : nullptr);
+
+		if (canonicalVertices(&mesh) != canonicalVerticesPairwise(&mesh)) {
+			std::cout << "check-dedup: synthetic mesh " << meshNum << " (" << vertexCount << " vertices) differs from the pairwise scan" << std::endl;
+			return false;
+		}
+	}
+
+	std::cout << "check-dedup: OK" << std::endl;
+	return true;
+}
+
+compressed_mesh_t process_mesh(mesh_t *mesh) {
+	using namespace triangle_stripper;
+	
+	int32 n = mesh->submesh_count + mesh->logical_submesh_count;
+	// one entry per submesh and lod level, see native::meshLodLevels
+	std::vector<primitive_vector> pvecs(n * native::meshLodLevels);
+	std::vector<std::vector<meshlet>> meshMeshlets(n * native::meshLodLevels);
+	// entry whose meshlets each entry uses, differs for levels that weren't worth simplifying
+	std::vector<size_t> lodSource(n * native::meshLodLevels);
+	for (size_t i = 0; i < lodSource.size(); i++) {
+		lodSource[i] = i;
+	}
+
+	size_t totalIndices = 0, strips = 0,  totalTrilist = 0;
+
+	bool colored = mesh->col != nullptr;
+	bool normaled = mesh->normals != nullptr;
+	bool texcoorded = mesh->uv != nullptr;
+	
+	Sphere boundingSphere = calculateBoundingSphere((V3d*)mesh->vertices, mesh->vertex_count);
+
+	auto vertices = (V3d*)mesh->vertices;
+	auto normals = (V3d*)mesh->normals;
+	auto texcoords = (TexCoords*)mesh->uv;
+	auto colors = (RGBA*)mesh->col;
+
+	auto canonicalIdx = canonicalVertices(mesh);
 
 	size_t dups = 0;
 	for (size_t i = 0; i < mesh->vertex_count; i++) {
@@ -1142,66 +1641,45 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
 		for (size_t i = 0; i < submesh->index_count; i++) {
 			submesh->indices[i] = canonicalIdx[submesh->indices[i]];
 		}
-#if 0
-		if (submesh->index_count > 1500)
-		{
-			float target_error = 0.1f;
-			float threshold = 1500.0f/submesh->index_count;
-			auto& src = *submesh;
-			size_t ic = src.index_count;
-
-			// build input index vector
-			std::vector<unsigned int> inIndices(ic);
-			for (size_t j = 0; j < ic; ++j)
-				inIndices[j] = src.indices[j];
-
-			// prepare output buffer (max size = ic)
-			std::vector<unsigned int> outIndices(ic);
-			float lod_error = 0.f;
-
-			// target index count = floor(ic * threshold)
-			size_t target_ic = size_t(ic * threshold);
-			if (target_ic < 3) target_ic = 3; // at least one triangle
-
-			// run the simplifier
-			size_t new_ic = meshopt_simplify(
-				outIndices.data(),
-				inIndices.data(),
-				ic,
-				mesh->vertices,
-				mesh->vertex_count,
-				sizeof(float) * 3,
-				target_ic,
-				target_error,
-				&lod_error
-			);
-
-			// shrink to actual size
-			outIndices.resize(new_ic);
-
-			// allocate and copy back to uint16_t indices
-			submesh->index_count = new_ic;
-			free(submesh->indices);
-			submesh->indices     = (uint16_t*)malloc(sizeof(uint16_t)*new_ic);
-			for (size_t j = 0; j < new_ic; ++j)
-				submesh->indices[j] = uint16_t(outIndices[j]);
-
-			texconvf("Submesh %u: %zu→%zu indices (error=%f)\n", submeshNum, ic, new_ic, lod_error);
-		}
-		#endif
-		{
-			indices Indices(submesh->indices, submesh->indices + submesh->index_count);
-
-			tri_stripper TriStripper(Indices);
-
-			TriStripper.SetMinStripSize(0);
-			TriStripper.SetCacheSize(0);
-			TriStripper.SetBackwardSearch(true);
-
-			TriStripper.Strip(&pvecs[submeshNum]);
-		}
-
-		for (auto &&strip: pvecs[submeshNum]) {
+		if (submesh->index_count) {
+			std::vector<unsigned int> lodIndices(submesh->indices, submesh->indices + submesh->index_count);
+			stripClusters(lodIndices, mesh->vertices, mesh->vertex_count, pvecs[submeshNum * native::meshLodLevels]);
+
+			// each level halves the previous one. The border is locked so that seams between submeshes
+			// don't open up when neighbouring submeshes end up on different levels
+			for (unsigned lod = 1; lod < native::meshLodLevels; lod++) {
+				size_t entry = submeshNum * native::meshLodLevels + lod;
+				size_t target = lodIndices.size() / 6 * 3;
+				std::vector<unsigned int> simplified(lodIndices.size());
+				float lodError = 0.f;
+
+				size_t simplifiedCount = target < 3 ? lodIndices.size() : meshopt_simplify(
+					simplified.data(),
+					lodIndices.data(),
+					lodIndices.size(),
+					mesh->vertices,
+					mesh->vertex_count,
+					sizeof(float) * 3,
+					target,
+					meshLodMaxError[lod],
+					meshopt_SimplifyLockBorder,
+					&lodError
+				);
+
+				// not worth the space, reuse the previous level
+				if (simplifiedCount == 0 || simplifiedCount > lodIndices.size() * 85 / 100) {
+					lodSource[entry] = lodSource[entry - 1];
+					continue;
+				}
+
+				simplified.resize(simplifiedCount);
+				texconvf("Submesh %d lod %u: %zu -> %zu indices (error=%f)\n", submeshNum, lod, lodIndices.size(), simplifiedCount, lodError);
+				lodIndices = std::move(simplified);
+				stripClusters(lodIndices, mesh->vertices, mesh->vertex_count, pvecs[entry]);
+			}
+		}
+
+		for (auto &&strip: pvecs[submeshNum * native::meshLodLevels]) {
 			totalIndices += strip.Indices.size();
 			if (strip.Type == TRIANGLES) {
 				assert(strip.Indices.size()%3==0);
@@ -1218,82 +1696,11 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
 	
 	size_t meshIndexesCount = 0;
 	size_t meshVerticesCount = 0;
-	size_t meshletIndexesCount = 0;
-	size_t meshletVerticesCount = 0;
+	meshlet_stats_t meshletStats = { 0, 0, 0, meshletMaxVertices };
 	for (int pvn = 0; pvn < pvecs.size(); pvn++) {
 		auto &&prims = pvecs[pvn];
 
-		std::set<uint16_t> meshletVertices;
-		std::vector<primitive_group*> meshletStrips;
-
-		std::list<primitive_group*> strips;
-		for (auto &&strip: prims) {
-			strips.push_back(&strip);
-		}
-		#undef printf
-
-		while(strips.size()) {
-			for(;;) {
-				// pluck strip with fewest new indices
-
-				primitive_group* bestStrip = nullptr;
-
-				size_t remainingVertices = 128 - meshletVertices.size();
-				size_t bestSharedVertices = 0;
-
-				for (auto &&strip_ptr: strips) {
-					auto &&strip = *strip_ptr;
-					std::set<uint16_t> newVertices;
-					size_t sharedVertices = 0;
-					for (auto &&idx: strip.Indices) {
-						if (meshletVertices.find(idx) == meshletVertices.end()) {
-							newVertices.insert(idx);
-						} else {
-							sharedVertices++;
-						}
-					}
-					if (newVertices.size() == 0) {
-						bestStrip = strip_ptr;
-						break;
-					}
-					if (newVertices.size() <= remainingVertices && sharedVertices >= bestSharedVertices) {
-						bestStrip = strip_ptr;
-						bestSharedVertices = sharedVertices;
-					}
-				}
-
-				if (bestStrip == nullptr) {
-					break;
-				}
-
-				// add strip to meshlet
-				meshletStrips.push_back(bestStrip);
-				for (auto &&idx: bestStrip->Indices) {
-					meshletVertices.insert(idx);
-				}
-				strips.remove(bestStrip);
-			}
-
-			assert(meshletStrips.size() != 0);
-
-			// printf("Meshlet constructed, %ld strips, %zu vertices\n", meshletStrips.size(), meshletVertices.size());
-			for (auto &&strip: meshletStrips) {
-				meshletIndexesCount += strip->Indices.size();
-			}
-			meshletVerticesCount += meshletVertices.size();
-
-			meshMeshlets[pvn].push_back(meshlet{meshletVertices, {}, meshletStrips, 0, 0});
-
-			uint8_t localIndex = 0;
-			for (auto &&idx: meshletVertices) {
-				meshMeshlets[pvn].back().vertexToLocalIndex[idx] = localIndex++;
-			}
-
-			assert(localIndex <= 128);
-
-			meshletStrips.clear();
-			meshletVertices.clear();
-		}
+		meshMeshlets[pvn] = buildMeshlets(prims, vertices, &meshletStats);
 
 		std::set<uint16_t> meshVertices;
 		for (auto &&strip: prims) {
@@ -1304,7 +1711,14 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
 		}
 		meshVerticesCount += meshVertices.size();
 	}
+	size_t meshletIndexesCount = meshletStats.indices;
+	size_t meshletVerticesCount = meshletStats.vertices;
 	texconvf("%zu; %.2f; Meshlets complete %zu vertices %zu indexes from %zu vertices %zu indexes\n", meshletVerticesCount - meshVerticesCount, (float)(meshletVerticesCount - meshVerticesCount)/meshVerticesCount, meshletVerticesCount, meshletIndexesCount, meshVerticesCount, meshIndexesCount);
+	if (meshletStats.meshlets) {
+		texconvf("Meshlet fill: %zu meshlets, %.2f%% average, %.2f%% min, %.1f indices per meshlet\n", meshletStats.meshlets, (float)meshletStats.vertices / (meshletStats.meshlets * meshletMaxVertices) * 100, (float)meshletStats.minVertices / meshletMaxVertices * 100, (float)meshletStats.indices / meshletStats.meshlets);
+	}
+
+	size_t conedMeshlets = 0;
 
 	write_vector meshData;
 	write_vector meshletData;
@@ -1313,14 +1727,37 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
 	write_vector skinningIndexData;
 	write_vector skinningWeightData;
 
-	for (size_t i = 0; i < meshMeshlets.size(); i++) {
+	// finest levels are written first so they always get an offset, coarser levels that
+	// would overflow the int16 offset fall back to the level before them
+	std::vector<size_t> writeOrder;
+	for (unsigned lod = 0; lod < native::meshLodLevels; lod++) {
+		for (size_t i = lod; i < meshMeshlets.size(); i += native::meshLodLevels) {
+			writeOrder.push_back(i);
+		}
+	}
+
+	auto meshInfoSize = meshMeshlets.size() * sizeof(native::MeshInfo);
+	std::vector<native::MeshInfo> meshInfos(meshMeshlets.size());
+
+	for (auto i: writeOrder) {
 		auto &&mesh = meshMeshlets[i];
+
+		if (lodSource[i] != i) {
+			continue;
+		}
+
+		if (i % native::meshLodLevels && (meshletData.size() + meshInfoSize) > 32767) {
+			texconvf("Dropping lod %zu of submesh %zu, out of meshlet offsets\n", i % native::meshLodLevels, i / native::meshLodLevels);
+			mesh.clear();
+			lodSource[i] = i - 1;
+			continue;
+		}
 		
 		assert(mesh.size() <= 32767);
-		meshData.write<int16_t>(mesh.size());
+		meshInfos[i].meshletCount = mesh.size();
 
-		assert((meshletData.size() + meshMeshlets.size() * 4) <= 32767);
-		meshData.write<int16_t>(meshletData.size() + meshMeshlets.size() * 4);
+		assert((meshletData.size() + meshInfoSize) <= 32767);
+		meshInfos[i].meshletOffset = meshletData.size() + meshInfoSize;
 
 		for (auto && meshlet: mesh) {
 			auto boundingSphere = meshlet.calculateBoundingSphere(vertices);
@@ -1384,9 +1821,37 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
 			meshletData.write<uint32_t>(meshlet.vertexDataOffset); // will be patched
 			meshlet.rewriteOffsetIDO = meshletData.size();
 			meshletData.write<uint32_t>(meshlet.indexDataOffset); // will be patched
+			int8_t coneAxis[3];
+			int8_t coneCutoff;
+			meshlet.calculateNormalCone(vertices, coneAxis, &coneCutoff);
+			if (!meshlet.coneCullsOnlyBackfaces(vertices, boundingSphere, coneAxis, coneCutoff)) {
+				texconvf("Warning: normal cone would cull front facing triangles, disabled\n");
+				coneAxis[0] = coneAxis[1] = coneAxis[2] = 0;
+				coneCutoff = 127;
+			}
+			meshletData.write<int8_t>(coneAxis[0]);
+			meshletData.write<int8_t>(coneAxis[1]);
+			meshletData.write<int8_t>(coneAxis[2]);
+			meshletData.write<int8_t>(coneCutoff);
+			if (coneCutoff != 127) {
+				conedMeshlets++;
+			}
 		}
 	}
 
+	texconvf("Normal cones on %zu meshlets\n", conedMeshlets);
+
+	// sources always come before the levels using them
+	for (size_t i = 0; i < meshInfos.size(); i++) {
+		if (lodSource[i] != i) {
+			assert(lodSource[i] < i);
+			meshInfos[i] = meshInfos[lodSource[i]];
+		}
+		meshData.write<int16_t>(meshInfos[i].meshletCount);
+		meshData.write<int16_t>(meshInfos[i].meshletOffset);
+	}
+	assert(meshData.size() == meshInfoSize);
+
 	assert(skinningIndexData.size() % 2 == 0);
 
 	bool isIdx8 = mesh->vertex_count < 256;
@@ -1496,7 +1961,90 @@ compressed_mesh_t process_mesh(mesh_t *mesh) {
     return { boundingSphere, quadData, meshlets };
 }
 
+// Static bvh over the world bounding spheres of non movable game objects
+// Written flattened in depth first order, each node stores where to skip to when culled
+constexpr size_t staticBvhLeafSize = 4;
+
+struct static_bvh_item_t {
+	Sphere sphere;
+	uint32_t gameObjectIndex;
+};
+
+Sphere mergeBoundingSpheres(const Sphere& a, const Sphere& b) {
+	if (a.radius == 0.0f) return b;
+	if (b.radius == 0.0f) return a;
+
+	V3d d = sub(b.center, a.center);
+	float dist = length(d);
+
+	if (a.radius >= dist + b.radius) return a;
+	if (b.radius >= dist + a.radius) return b;
+
+	float r = (dist + a.radius + b.radius) * 0.5f;
+	return Sphere{ add(a.center, scale(d, (r - a.radius) / dist)), r };
+}
+
+Sphere transformBoundingSphere(const native::r_matrix_t& ltw, const Sphere& sphere) {
+	Sphere rv;
+	rv.center = add(add(scale(ltw.right, sphere.center.x), scale(ltw.up, sphere.center.y)), add(scale(ltw.at, sphere.center.z), ltw.pos));
+	float maxScale = std::max(length(ltw.right), std::max(length(ltw.up), length(ltw.at)));
+	rv.radius = sphere.radius * maxScale;
+	return rv;
+}
+
+void buildStaticBvh(std::vector<static_bvh_item_t>& items, size_t begin, size_t end, std::vector<native::static_bvh_node_t>& nodes, std::vector<uint32_t>& objects) {
+	auto nodeNum = nodes.size();
+	nodes.push_back({});
+
+	Sphere bounds = items[begin].sphere;
+	for (size_t i = begin + 1; i < end; i++) {
+		bounds = mergeBoundingSpheres(bounds, items[i].sphere);
+	}
+	// the runtime recomputes ltw from position/rotation/scale, leave some room for rounding
+	bounds.radius = bounds.radius * 1.01f + 0.01f;
+
+	if (end - begin <= staticBvhLeafSize) {
+		nodes[nodeNum].firstObject = objects.size();
+		nodes[nodeNum].objectCount = end - begin;
+		for (size_t i = begin; i < end; i++) {
+			objects.push_back(items[i].gameObjectIndex);
+		}
+	} else {
+		// median split along the longest axis of the centers
+		V3d minc = items[begin].sphere.center, maxc = items[begin].sphere.center;
+		for (size_t i = begin + 1; i < end; i++) {
+			auto& c = items[i].sphere.center;
+			minc = { std::min(minc.x, c.x), std::min(minc.y, c.y), std::min(minc.z, c.z) };
+			maxc = { std::max(maxc.x, c.x), std::max(maxc.y, c.y), std::max(maxc.z, c.z) };
+		}
+		V3d extent = sub(maxc, minc);
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		auto key = [axis](const static_bvh_item_t& item) {
+			return axis == 0 ? item.sphere.center.x : axis == 1 ? item.sphere.center.y : item.sphere.center.z;
+		};
+
+		size_t mid = begin + (end - begin) / 2;
+		std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [&key](const static_bvh_item_t& a, const static_bvh_item_t& b) {
+			return key(a) < key(b);
+		});
+
+		nodes[nodeNum].firstObject = 0;
+		nodes[nodeNum].objectCount = 0;
+		buildStaticBvh(items, begin, mid, nodes, objects);
+		buildStaticBvh(items, mid, end, nodes, objects);
+	}
+
+	nodes[nodeNum].bounds = bounds;
+	nodes[nodeNum].skip = nodes.size();
+}
+
+static std::mutex cout_mutex;
+
 int main(int argc, const char** argv) {
+    if (argc == 2 && strcmp(argv[1], "--check-dedup") == 0) {
+        return checkVertexDedup() ? 0 : 1;
+    }
+
     if (argc != 3) {
         std::cout << argv[0] << " <scene.dat> <scene.ndt>" << std::endl;
         return 1;
@@ -1513,6 +2061,16 @@ int main(int argc, const char** argv) {
 	std::map<sha256_type, size_t> native_textures_map;
     std::map<texture_t*, size_t> native_textures_index;
 
+    struct texture_job_t {
+        texture_t* tex;
+        std::string tga_filename;
+        std::string pvr_filename;
+    };
+
+    std::vector<texture_job_t> texture_encodes;
+    std::set<sha256_type> texture_encodes_set;
+    std::vector<std::pair<sha256_type, std::string>> texture_hashes;
+
     for (auto& tex: textures) {
         hash_sha256 hash;
         hash.sha256_init();
@@ -1539,36 +2097,81 @@ int main(int argc, const char** argv) {
 
         std::cout << "Processing texture: " << pvr_filename << " " << tex->file << std::endl;
 
-        if (!std::filesystem::exists(pvr_filename)) {
-            auto imageData = createImageFromData_ARGB8888((const uint8_t*)tex->data, tex->width, tex->height, tex->width * 4);
-            auto nw = std::min(128, tex->width/2);
-            if (tex->width < 16) {
-                nw = tex->width;
-			}
-            auto nh = std::min(128, tex->height/2);
-            if (tex->height < 16) {
-                nh = tex->height;
+        // identical textures are only encoded once
+        if (!std::filesystem::exists(pvr_filename) && texture_encodes_set.insert(hash_result).second) {
+            texture_encodes.push_back({tex, tga_filename, pvr_filename});
+        }
+
+        texture_hashes.push_back({hash_result, pvr_filename});
+    }
+
+    // Encode cache misses in parallel, every job writes its own tga/pvr pair
+    {
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (;;) {
+                size_t j = next++;
+                if (j >= texture_encodes.size()) {
+                    break;
+                }
+                auto tex = texture_encodes[j].tex;
+                auto& tga_filename = texture_encodes[j].tga_filename;
+                auto& pvr_filename = texture_encodes[j].pvr_filename;
+
+                auto imageData = createImageFromData_ARGB8888((const uint8_t*)tex->data, tex->width, tex->height, tex->width * 4);
+                auto nw = std::min(128, tex->width/2);
+                if (tex->width < 16) {
+                    nw = tex->width;
+                }
+                auto nh = std::min(128, tex->height/2);
+                if (tex->height < 16) {
+                    nh = tex->height;
+                }
+                assert(nw >= 8);
+                assert(nh >= 8);
+        
+                imageData = downscaleImage(imageData, tex->width, tex->height, nw, nh);
+                writeTGA(tga_filename.c_str(), imageData, nw, nh, 32);
+        
+                std::stringstream encodeCmd;
+                encodeCmd << "../vendor/pvrtex/pvrtex -i " << tga_filename << " -o " << pvr_filename << " -c small -d";
+
+                {
+                    std::lock_guard<std::mutex> lock(cout_mutex);
+                    std::cout << "Runing: " << encodeCmd.str() << std::endl;
+                }
+                auto res = system(encodeCmd.str().c_str());
+
+                assert(res == 0);
             }
-            assert(nw >= 8);
-            assert(nh >= 8);
-    
-            imageData = downscaleImage(imageData, tex->width, tex->height, nw, nh);
-            writeTGA(tga_filename.c_str(), imageData, nw, nh, 32);
-    
-            std::stringstream encodeCmd;
-            encodeCmd << "../vendor/pvrtex/pvrtex -i " << tga_filename << " -o " << pvr_filename << " -c small -d";
-    
-            std::cout << "Runing: " << encodeCmd.str() << std::endl;
-            auto res = system(encodeCmd.str().c_str());
+        };
+
+        unsigned jobs = std::thread::hardware_concurrency();
+        if (auto env = getenv("REPACKER_JOBS")) {
+            jobs = atoi(env);
+        }
+        jobs = std::clamp<size_t>(jobs, 1, std::max<size_t>(texture_encodes.size(), 1));
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < jobs; i++) {
+            pool.emplace_back(worker);
+        }
+        worker();
 
-            assert(res == 0);
+        for (auto& t: pool) {
+            t.join();
         }
+    }
+
+    // Load in scene order, so the output does not depend on encode order
+    for (size_t i = 0; i < textures.size(); i++) {
+        auto& [hash_result, pvr_filename] = texture_hashes[i];
 
 		if (native_textures_map.find(hash_result) == native_textures_map.end()) {
 			native_textures_map[hash_result] = native_textures.size();
 			native_textures.push_back(loadPVR(pvr_filename.c_str()));
 		}
-        native_textures_index[tex] = native_textures_map[hash_result];
+        native_textures_index[textures[i]] = native_textures_map[hash_result];
     }
 
 	std::vector<compressed_mesh_t> native_meshes;
@@ -1608,7 +2211,7 @@ int main(int argc, const char** argv) {
             auto compressed_mesh = process_mesh(mesh);
             auto mesh_file = std::ofstream(mesh_filename);
 
-            mesh_file.write("DCUENM02", 8);
+            mesh_file.write("DCUENM04", 8);
             mesh_file.write((const char*)&compressed_mesh.bounding_sphere, sizeof(compressed_mesh.bounding_sphere));
 			uint32_t tmp = compressed_mesh.quadData.size();
 			mesh_file.write((const char*)&tmp, sizeof(tmp));
@@ -1620,7 +2223,7 @@ int main(int argc, const char** argv) {
 			auto mesh_file = std::ifstream(mesh_filename);
 			char tag[9] = { 0 };
 			mesh_file.read(tag, 8);
-			if (memcmp(tag, "DCUENM02", 8) != 0) {
+			if (memcmp(tag, "DCUENM04", 8) != 0) {
 				std::cout << "Unexpeted mesh tag " << tag << std::endl;
 				return 1;
 			}
@@ -1648,102 +2251,142 @@ int main(int argc, const char** argv) {
 
 	std::cout << "Writting out scene " << argv[2] << std::endl;
 
-	auto outfile = std::ofstream(argv[2]);
+	write_vector sections[native::ss_count];
 
-    outfile.write("DCUENS05", 8);
-    
-	uint32_t tmp;
-
-	tmp = (uint32_t)native_textures.size();
-	outfile.write((char*)&tmp, sizeof(tmp));
-	for(auto& native_tex: native_textures) {
-		tmp = (uint32_t)native_tex.data.size();
-		outfile.write((char*)&tmp, sizeof(tmp));
-
-		outfile.write((char*)&native_tex.flags, sizeof(native_tex.flags));
-		outfile.write((char*)&native_tex.offs, sizeof(native_tex.offs));
-		outfile.write((char*)&native_tex.lw, sizeof(native_tex.lw));
-		outfile.write((char*)&native_tex.lh, sizeof(native_tex.lh));
-
-		outfile.write((char*)native_tex.data.data(), native_tex.data.size());
+	{
+		auto& section = sections[native::ss_textures];
+		section.write<uint32_t>(native_textures.size());
+		size_t dataOffset = sizeof(uint32_t) + native_textures.size() * sizeof(native::scene_texture_t);
+		for(auto& native_tex: native_textures) {
+			dataOffset = (dataOffset + 31) & ~31;
+			native::scene_texture_t sceneTexture = { };
+			sceneTexture.size = native_tex.data.size();
+			sceneTexture.dataOffset = dataOffset;
+			sceneTexture.flags = native_tex.flags;
+			sceneTexture.offs = native_tex.offs;
+			sceneTexture.lw = native_tex.lw;
+			sceneTexture.lh = native_tex.lh;
+			section.write(sceneTexture);
+			dataOffset += native_tex.data.size();
+		}
+		for(auto& native_tex: native_textures) {
+			section.resize((section.size() + 31) & ~31);
+			section.insert(section.end(), native_tex.data.begin(), native_tex.data.end());
+		}
 	}
 
 	std::map<material_t*, size_t> native_materials_index;
-	tmp = (uint32_t)materials.size();
-	outfile.write((char*)&tmp, sizeof(tmp));
 	for (auto& material: materials) {
-		outfile.write((char*)&material->mode, sizeof(material->mode));
-		outfile.write((char*)&material->a, sizeof(material->a));
-		outfile.write((char*)&material->r, sizeof(material->r));
-		outfile.write((char*)&material->g, sizeof(material->g));
-		outfile.write((char*)&material->b, sizeof(material->b));
-		outfile.write((char*)&material->ea, sizeof(material->ea));
-		outfile.write((char*)&material->er, sizeof(material->er));
-		outfile.write((char*)&material->eg, sizeof(material->eg));
-		outfile.write((char*)&material->eb, sizeof(material->eb));
+		native::scene_material_t sceneMaterial = { };
+		sceneMaterial.mode = material->mode;
+		sceneMaterial.color = { material->a, material->r, material->g, material->b };
+		sceneMaterial.emission = { material->ea, material->er, material->eg, material->eb };
 		if (material->texture) {
-			tmp = native_textures_index[material->texture];
+			sceneMaterial.texture = native_textures_index[material->texture];
 		} else {
-			tmp = UINT32_MAX;
+			sceneMaterial.texture = UINT32_MAX;
 		}
-		outfile.write((char*)&tmp, sizeof(tmp));
+		sections[native::ss_materials].write(sceneMaterial);
 		native_materials_index[material] = native_materials_index.size();
 	}
 
-	tmp = (uint32_t)native_meshes.size();
-	outfile.write((char*)&tmp, sizeof(tmp));
-	for (auto& native_mesh: native_meshes) {
-		tmp = native_mesh.quadData.size();
-		outfile.write((char*)&tmp, sizeof(tmp));
-		tmp = native_mesh.data.size();
-		outfile.write((char*)&tmp, sizeof(tmp));
-		outfile.write((char*)&native_mesh.bounding_sphere, sizeof(native_mesh.bounding_sphere));
-		outfile.write((char*)native_mesh.quadData.data(), native_mesh.quadData.size());
-		outfile.write((char*)native_mesh.data.data(), native_mesh.data.size());
+	{
+		auto& section = sections[native::ss_meshes];
+		section.write<uint32_t>(native_meshes.size());
+		section.resize(section.size() + native_meshes.size() * sizeof(uint32_t));
+		for (size_t meshNum = 0; meshNum < native_meshes.size(); meshNum++) {
+			auto& native_mesh = native_meshes[meshNum];
+			section.resize((section.size() + 31) & ~31);
+
+			size_t meshOffset = section.size();
+			section.rewrite<uint32_t>(sizeof(uint32_t) + meshNum * sizeof(uint32_t), meshOffset);
+
+			native::mesh_t header = { };
+			header.bounding_sphere = native_mesh.bounding_sphere;
+			header.quadDataPad = (sizeof(native::mesh_t) + native_mesh.data.size() + 3) & ~3;
+			section.write(header);
+			section.insert(section.end(), native_mesh.data.begin(), native_mesh.data.end());
+			section.resize(meshOffset + header.quadDataPad);
+			section.insert(section.end(), native_mesh.quadData.begin(), native_mesh.quadData.end());
+		}
 	}
 
-	tmp = (uint32_t)gameObjects.size();
-	outfile.write((char*)&tmp, sizeof(tmp));
+	std::vector<static_bvh_item_t> staticBvhItems;
+
 	for (auto& gameObject: gameObjects) {
-		outfile.write((char*)&gameObject->active, sizeof(gameObject->active));
-		outfile.write((char*)&gameObject->movable, sizeof(gameObject->movable));
+		native::scene_game_object_t sceneGameObject = { };
+		sceneGameObject.active = gameObject->active;
+		sceneGameObject.movable = gameObject->movable;
+		sceneGameObject.mesh_enabled = gameObject->mesh_enabled;
 		native::r_matrix_t ltw = {
 			gameObject->transform->m00, gameObject->transform->m10, gameObject->transform->m20, gameObject->transform->m30,
 			gameObject->transform->m01, gameObject->transform->m11, gameObject->transform->m21, gameObject->transform->m31,
 			gameObject->transform->m02, gameObject->transform->m12, gameObject->transform->m22, gameObject->transform->m32,
 			gameObject->transform->m03, gameObject->transform->m13, gameObject->transform->m23, gameObject->transform->m33
 		};
-		outfile.write((char*)&ltw, sizeof(ltw));
-		outfile.write((char*)&gameObject->mesh_enabled, sizeof(gameObject->mesh_enabled));
+		sceneGameObject.ltw = ltw;
+
+		if (gameObject->mesh && !gameObject->movable) {
+			auto& bounding_sphere = native_meshes[native_meshes_index[gameObject->mesh]].bounding_sphere;
+			staticBvhItems.push_back({ transformBoundingSphere(ltw, bounding_sphere), (uint32_t)(&gameObject - &gameObjects[0]) });
+		}
+
 		if (gameObject->mesh) {
-			tmp = native_meshes_index[gameObject->mesh];
+			sceneGameObject.mesh = native_meshes_index[gameObject->mesh];
 		} else {
-			tmp = UINT32_MAX;
+			sceneGameObject.mesh = UINT32_MAX;
 		}
-		outfile.write((char*)&tmp, sizeof(tmp));
 
-		tmp = gameObject->mesh ? gameObject->mesh->submesh_count : 0;
-		outfile.write((char*)&tmp, sizeof(tmp));
-		if (gameObject->mesh) {
-			for (int materialNum = 0; materialNum < gameObject->mesh->submesh_count; materialNum++) {
-				if (gameObject->materials[materialNum]) {
-					tmp = native_materials_index[gameObject->materials[materialNum]];
-				} else {
-					tmp = UINT32_MAX;
-				}
-				outfile.write((char*)&tmp, sizeof(tmp));
+		auto& materialsSection = sections[native::ss_game_object_materials];
+		sceneGameObject.submeshCount = gameObject->mesh ? gameObject->mesh->submesh_count : 0;
+		sceneGameObject.firstMaterial = materialsSection.size() / sizeof(uint32_t);
+		for (uint32_t materialNum = 0; materialNum < sceneGameObject.submeshCount; materialNum++) {
+			if (gameObject->materials[materialNum]) {
+				materialsSection.write<uint32_t>(native_materials_index[gameObject->materials[materialNum]]);
+			} else {
+				materialsSection.write<uint32_t>(UINT32_MAX);
 			}
 		}
+		sections[native::ss_game_objects].write(sceneGameObject);
 	}
 
-	for (int i = 0; i < 6; i++) {
-		tmp = native_textures_index[textures[skybox[i]]];
-		outfile.write((char*)&tmp, sizeof(tmp));
+	{
+		native::scene_skybox_t sceneSkybox;
+		for (int i = 0; i < 6; i++) {
+			sceneSkybox.textures[i] = native_textures_index[textures[skybox[i]]];
+		}
+		sceneSkybox.tint = skyboxTint;
+		sections[native::ss_skybox].write(sceneSkybox);
+	}
+
+	std::vector<native::static_bvh_node_t> staticBvhNodes;
+	std::vector<uint32_t> staticBvhObjects;
+	if (staticBvhItems.size()) {
+		buildStaticBvh(staticBvhItems, 0, staticBvhItems.size(), staticBvhNodes, staticBvhObjects);
+	}
+	std::cout << "Static bvh: " << staticBvhNodes.size() << " nodes, " << staticBvhObjects.size() << " objects" << std::endl;
+
+	for (auto& node: staticBvhNodes) {
+		sections[native::ss_static_bvh_nodes].write(node);
 	}
-	outfile.write(reinterpret_cast<char*>(&skyboxTint.alpha), sizeof(skyboxTint.alpha));
-	outfile.write(reinterpret_cast<char*>(&skyboxTint.red), sizeof(skyboxTint.red));
-	outfile.write(reinterpret_cast<char*>(&skyboxTint.green), sizeof(skyboxTint.green));
-	outfile.write(reinterpret_cast<char*>(&skyboxTint.blue), sizeof(skyboxTint.blue));
+	for (auto gameObjectIndex: staticBvhObjects) {
+		sections[native::ss_static_bvh_objects].write(gameObjectIndex);
+	}
+
+	write_vector scene;
+	scene.insert(scene.end(), { 'D', 'C', 'U', 'E', 'N', 'S', '0', '9' });
+	scene.write<uint32_t>(native::ss_count);
+	size_t sectionTableOffset = scene.size();
+	scene.resize(scene.size() + sizeof(native::scene_section_header_t) * native::ss_count);
+	for (int sectionNum = 0; sectionNum < native::ss_count; sectionNum++) {
+		scene.resize((scene.size() + native::sceneSectionAlignment - 1) & ~(native::sceneSectionAlignment - 1));
+		native::scene_section_header_t header = { (uint32_t)scene.size(), (uint32_t)sections[sectionNum].size() };
+		scene.rewrite(sectionTableOffset + sectionNum * sizeof(header), header);
+		scene.insert(scene.end(), sections[sectionNum].begin(), sections[sectionNum].end());
+	}
+
+	auto outfile = std::ofstream(argv[2], std::ios::binary);
+	outfile.write((const char*)scene.data(), scene.size());
 
 	return 0;
 